@@ -1,6 +1,11 @@
 ; Identical to lesson 13's boot sector, but the %included files have new paths
 [org 0x7c00]
-KERNEL_OFFSET equ 0x1000 ; The same one we used when linking the kernel
+KERNEL_OFFSET equ 0x10000 ; The same one we used when linking the kernel
+
+; The Makefile passes the real kernel size in sectors with -DKERNEL_SECTORS
+%ifndef KERNEL_SECTORS
+%define KERNEL_SECTORS 31
+%endif
 
     xor ax, ax
     mov ds, ax
@@ -34,10 +39,15 @@ load_kernel:
     call print
     call print_nl
 
-    mov bx, KERNEL_OFFSET ; Read from disk and store in 0x1000
-    mov dh, 31 ; Our future kernel will be larger, make this big
+    mov ax, KERNEL_OFFSET >> 4 ; Read from disk and store in 0x10000
+    mov es, ax
+    mov di, KERNEL_SECTORS
     mov dl, [BOOT_DRIVE]
     call disk_load
+
+    in al, 0x92 ; Fast A20 gate: the kernel heap lives above 1MB
+    or al, 2
+    out 0x92, al
     ret
 
 [bits 32]
@@ -52,7 +62,6 @@ BOOT_DRIVE db 0 ; It is a good idea to store it in memory because 'dl' may get o
 MSG_REAL_MODE db "Started in 16-bit Real Mode", 0
 MSG_PROT_MODE db "Landed in 32-bit Protected Mode", 0
 MSG_LOAD_KERNEL db "Loading kernel into memory", 0
-MSG_RETURNED_KERNEL db "Returned from kernel. Error?", 0
 
 ; padding
 times 510 - ($-$$) db 0
@@ -1,28 +1,41 @@
-; load 'dh' sectors from drive 'dl' into ES:BX
+; load 'di' sectors from drive 'dl' into ES:0, starting at the sector
+; right after the boot sector. We read one sector per int 0x13 call and
+; walk the 1.44MB floppy geometry ourselves, so the kernel may span as
+; many tracks as it needs.
+SECTORS_PER_TRACK equ 18
+
 disk_load:
     pusha
-    ; reading from disk requires setting specific values in all registers
-    ; so we will overwrite our input parameters from 'dx'. Let's save it
-    ; to the stack for later use.
-    push dx
+    mov si, 1 ; si <- LBA of the next sector (0 is the boot sector)
 
-    mov ah, 0x02 ; ah <- int 0x13 function. 0x02 = 'read'
-    mov al, dh   ; al <- number of sectors to read (0x01 .. 0x80)
-    mov cl, 0x02 ; cl <- sector (0x01 .. 0x11)
-                 ; 0x01 is our boot sector, 0x02 is the first 'available' sector
-    mov ch, 0x00 ; ch <- cylinder (0x0 .. 0x3FF, upper 2 bits in 'cl')
-    ; dl <- drive number. Our caller sets it as a parameter and gets it from BIOS
-    ; (0 = floppy, 1 = floppy2, 0x80 = hdd, 0x81 = hdd2)
-    mov dh, 0x00 ; dh <- head number (0x0 .. 0xF)
-
-    ; [es:bx] <- pointer to buffer where the data will be stored
-    ; caller sets it up for us, and it is actually the standard location for int 13h
+disk_load_loop:
+    ; LBA -> CHS: track = lba / 18, sector = lba % 18 + 1,
+    ; head = track % 2, cylinder = track / 2
+    push dx
+    mov ax, si
+    xor dx, dx
+    mov cx, SECTORS_PER_TRACK
+    div cx
+    mov cl, dl   ; cl <- sector (0x01 .. 0x12)
+    inc cl
+    mov ch, al   ; ch <- cylinder
+    shr ch, 1
+    pop dx       ; dl <- drive number, set by our caller
+    mov dh, al   ; dh <- head number (0x0 .. 0x1)
+    and dh, 1
+
+    xor bx, bx   ; [es:bx] <- where this sector is stored
+    mov ax, 0x0201 ; ah <- 0x02 = 'read', al <- 1 sector
     int 0x13      ; BIOS interrupt
     jc disk_error ; if error (stored in the carry bit)
 
-    pop dx
-    cmp al, dh    ; BIOS also sets 'al' to the # of sectors read. Compare it.
-    jne sectors_error
+    mov ax, es    ; next sector goes 512 bytes further
+    add ax, 0x20
+    mov es, ax
+    inc si
+    dec di
+    jnz disk_load_loop
+
     popa
     ret
 
@@ -33,14 +46,8 @@ disk_error:
     call print_nl
     mov dh, ah ; ah = error code, dl = disk drive that dropped the error
     call print_hex ; check out the code at http://stanislavs.org/helppc/int_13-1.html
-    jmp disk_loop
-
-sectors_error:
-    mov bx, SECTORS_ERROR
-    call print
 
 disk_loop:
     jmp $
 
 DISK_ERROR: db "Disk read error", 0
-SECTORS_ERROR: db "Incorrect number of sectors read", 0
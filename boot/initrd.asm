@@ -0,0 +1,13 @@
+; The archive built by tools/mkinitrd from rootfs/. It is linked last,
+; so it sits at the tail of kernel.bin and the boot sector loads it in
+; the same pass as the kernel: no driver is needed to get at it.
+[bits 32]
+section .rodata align=4096
+align 4096
+
+global initrd_start
+global initrd_end
+
+initrd_start:
+    incbin "initrd.img"
+initrd_end:
@@ -2,6 +2,7 @@
 #include "idt.h"
 #include "../drivers/screen.h"
 #include "../drivers/keyboard.h"
+#include "../drivers/serial.h"
 #include "../libc/string.h"
 #include "timer.h"
 #include "ports.h"
@@ -122,13 +123,7 @@ void isr_handler(registers_t *r) {
         isr_t handler = interrupt_handlers[r->int_no];
         handler(r);
     } else {
-        kprint("received interrupt: ");
-        char s[4];
-        int_to_ascii(r->int_no, s);
-        kprint(s);
-        kprint("\n");
-        kprint(exception_messages[r->int_no]);
-        kprint("\n");
+        kprintf("received interrupt: %u\n%s\n", r->int_no, exception_messages[r->int_no]);
     }
 }
 
@@ -156,4 +151,6 @@ void irq_install() {
     init_timer(50);
     /* IRQ1: keyboard */
     init_keyboard();
+    /* IRQ4: COM1 */
+    init_serial();
 }
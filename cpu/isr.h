@@ -93,4 +93,16 @@ void irq_install();
 typedef void (*isr_t)(registers_t*);
 void register_interrupt_handler(uint8_t n, isr_t handler);
 
+/* Disable interrupts and return the previous EFLAGS, so critical
+ * sections also work when we are already inside a handler */
+static inline uint32_t irq_save() {
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    asm volatile("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
 #endif
@@ -1,22 +1,25 @@
 #include "paging.h"
 #include "../drivers/screen.h"
+#include "../libc/mem.h"
 
 uint32_t page_directory[1024] __attribute__((aligned(4096)));
-uint32_t first_page_table[1024] __attribute__((aligned(4096)));
 
 void initialize_paging() {
-    // Identity map the first 4MB
-    for (int i = 0; i < 1024; i++) {
-        // As the address is page aligned, it will always be 0xXXXXX000
-        // 0x7 is (PRESENT | WRITABLE | USER)
-        first_page_table[i] = (i * 4096) | 7;
-    }
+    // Identity map everything up to the end of the heap
+    uint32_t tables = HEAP_END / (1024 * 4096);
 
-    // Set up the first entry in the page directory
-    page_directory[0] = ((uint32_t)first_page_table) | 7;
+    for (uint32_t t = 0; t < tables; t++) {
+        uint32_t *table = (uint32_t*)kmalloc(4096, 1, NULL);
+        for (int i = 0; i < 1024; i++) {
+            // As the address is page aligned, it will always be 0xXXXXX000
+            // 0x7 is (PRESENT | WRITABLE | USER)
+            table[i] = ((t * 1024 + i) * 4096) | 7;
+        }
+        page_directory[t] = ((uint32_t)table) | 7;
+    }
 
     // Set the rest of the page directory to not present
-    for (int i = 1; i < 1024; i++) {
+    for (int i = tables; i < 1024; i++) {
         page_directory[i] = 0 | 2; // Not present, but writable
     }
 
@@ -27,7 +30,42 @@ void initialize_paging() {
     uint32_t cr0;
     asm volatile("mov %%cr0, %0" : "=r"(cr0));
     cr0 |= 0x80000000;
+    // WP: read-only pages are read-only for the kernel too (see fs/mmap.c)
+    cr0 |= 0x10000;
     asm volatile("mov %0, %%cr0" : : "r"(cr0));
     
     kprint("Paging enabled.\n");
 }
+
+/* Page table covering 'virt', created on demand */
+static uint32_t *page_table_for(uint32_t virt, int create) {
+    uint32_t pde = page_directory[virt >> 22];
+    if (pde & PAGE_PRESENT) return (uint32_t*)(pde & ~0xFFF);
+    if (!create) return NULL;
+
+    uint32_t table = kpage_alloc();
+    if (!table) return NULL;
+    // The directory entry allows everything, each page decides
+    page_directory[virt >> 22] = table | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+    return (uint32_t*)table;
+}
+
+/* Map the page at 'virt' to the physical page 'phys' */
+int paging_map(uint32_t virt, uint32_t phys, uint32_t flags) {
+    uint32_t *table = page_table_for(virt, 1);
+    if (!table) return -1;
+    table[(virt >> 12) & 0x3FF] = (phys & ~0xFFF) | (flags & 0xFFF) | PAGE_PRESENT;
+    asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+    return 0;
+}
+
+/* Remove the mapping at 'virt'. Returns the old entry, so the caller
+ * can see where it pointed and whether it was written to. */
+uint32_t paging_unmap(uint32_t virt) {
+    uint32_t *table = page_table_for(virt, 0);
+    if (!table) return 0;
+    uint32_t entry = table[(virt >> 12) & 0x3FF];
+    table[(virt >> 12) & 0x3FF] = 0;
+    asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+    return entry;
+}
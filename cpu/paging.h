@@ -3,6 +3,14 @@
 
 #include <stdint.h>
 
+/* Page table entry flags */
+#define PAGE_PRESENT 0x01
+#define PAGE_WRITE   0x02
+#define PAGE_USER    0x04
+#define PAGE_DIRTY   0x40
+
 void initialize_paging();
+int paging_map(uint32_t virt, uint32_t phys, uint32_t flags);
+uint32_t paging_unmap(uint32_t virt);
 
 #endif
@@ -35,3 +35,25 @@ uint16_t port_word_in (uint16_t port) {
 void port_word_out (uint16_t port, uint16_t data) {
     asm volatile("out %%ax, %%dx" : : "a" (data), "d" (port));
 }
+
+uint32_t port_dword_in (uint16_t port) {
+    uint32_t result;
+    asm volatile("in %%dx, %%eax" : "=a" (result) : "d" (port));
+    return result;
+}
+
+void port_dword_out (uint16_t port, uint32_t data) {
+    asm volatile("out %%eax, %%dx" : : "a" (data), "d" (port));
+}
+
+/**
+ * Block transfers: move 'count' 16-bit words between a port and memory
+ * with a single 'rep insw'/'rep outsw', as disk controllers expect
+ */
+void port_words_in (uint16_t port, void *buffer, uint32_t count) {
+    asm volatile("rep insw" : "+D" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+void port_words_out (uint16_t port, void *buffer, uint32_t count) {
+    asm volatile("rep outsw" : "+S" (buffer), "+c" (count) : "d" (port));
+}
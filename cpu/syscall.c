@@ -1,15 +1,30 @@
 #include "syscall.h"
 #include "../drivers/screen.h"
 #include "../kernel/shell.h"
+#include "../fs/file.h"
+#include "../libc/mem.h"
+#include "../fs/mmap.h"
+
+/* User pointers are identity mapped like everything else, but they must
+ * at least stay inside mapped memory or one file mapping. The kernel
+ * writes to the buffer of a read, which a read-only mapping does not
+ * allow even from ring 0. */
+static int user_range_ok(uint32_t addr, uint32_t size, uint8_t write) {
+    if (addr == 0 || addr + size < addr) return 0;
+    if (addr + size <= HEAP_END) return 1;
+    return mmap_range_ok(addr, size, write);
+}
 
 static void syscall_handler(registers_t *regs) {
     // Syscall number in EAX
-    // Arguments in EBX, ECX, EDX, etc.
+    // Arguments in EBX, ECX, EDX, ESI; the result goes back in EAX
     uint32_t syscall_num = regs->eax;
+    int32_t ret = -1;
 
-    if (syscall_num == 0) { // print
+    if (syscall_num == SYS_PRINT) {
         kprint((char*)regs->ebx);
-    } else if (syscall_num == 1) { // exit
+        ret = 0;
+    } else if (syscall_num == SYS_EXIT) {
         // To return to kernel mode from here, we need to restore the kernel state.
         // For this simple example, we can use a longjmp-like approach or just
         // rely on the fact that we're in a syscall handler (Ring 0).
@@ -17,7 +32,32 @@ static void syscall_handler(registers_t *regs) {
         // Since we don't have a scheduler yet, we'll just print a message.
         kprint("\nUser Mode process requested exit.\n");
         shell_print_prompt();
+        ret = 0;
+    } else if (syscall_num == SYS_OPEN) {
+        // Names are relative to the shell's current directory
+        if (user_range_ok(regs->ebx, 1, 0)) ret = file_open((char*)regs->ebx, shell_get_dir(), regs->ecx);
+    } else if (syscall_num == SYS_CLOSE) {
+        ret = file_close(regs->ebx);
+    } else if (syscall_num == SYS_READ) {
+        if (user_range_ok(regs->ecx, regs->edx, 1)) ret = file_read(regs->ebx, (uint8_t*)regs->ecx, regs->edx);
+    } else if (syscall_num == SYS_WRITE) {
+        if (user_range_ok(regs->ecx, regs->edx, 0)) ret = file_write(regs->ebx, (uint8_t*)regs->ecx, regs->edx);
+    } else if (syscall_num == SYS_LSEEK) {
+        ret = file_lseek(regs->ebx, (int32_t)regs->ecx, regs->edx);
+    } else if (syscall_num == SYS_PREAD) {
+        if (user_range_ok(regs->ecx, regs->edx, 1)) ret = file_pread(regs->ebx, (uint8_t*)regs->ecx, regs->edx, regs->esi);
+    } else if (syscall_num == SYS_PWRITE) {
+        if (user_range_ok(regs->ecx, regs->edx, 0)) ret = file_pwrite(regs->ebx, (uint8_t*)regs->ecx, regs->edx, regs->esi);
+    } else if (syscall_num == SYS_APPEND) {
+        if (user_range_ok(regs->ecx, regs->edx, 0)) ret = file_append(regs->ebx, (uint8_t*)regs->ecx, regs->edx);
+    } else if (syscall_num == SYS_MMAP) {
+        ret = file_mmap(regs->ebx, regs->ecx, regs->edx, (regs->esi & (MAP_READ | MAP_SHARED)) | MAP_USER);
+    } else if (syscall_num == SYS_MUNMAP) {
+        // Kernel mappings are not the caller's to remove
+        if (mmap_is_user(regs->ebx)) ret = fs_munmap(regs->ebx);
     }
+
+    regs->eax = ret;
 }
 
 void init_syscalls() {
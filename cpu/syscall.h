@@ -4,6 +4,20 @@
 #include <stdint.h>
 #include "isr.h"
 
+/* int 0x80: number in EAX, arguments in EBX, ECX, EDX, ESI */
+#define SYS_PRINT  0 // (string)
+#define SYS_EXIT   1 // ()
+#define SYS_OPEN   2 // (name, flags) -> handle
+#define SYS_CLOSE  3 // (handle)
+#define SYS_READ   4 // (handle, buffer, size) -> bytes read
+#define SYS_WRITE  5 // (handle, buffer, size) -> bytes written
+#define SYS_LSEEK  6 // (handle, offset, whence) -> new position
+#define SYS_PREAD  7 // (handle, buffer, size, offset) -> bytes read
+#define SYS_PWRITE 8 // (handle, buffer, size, offset) -> bytes written
+#define SYS_APPEND 9 // (handle, buffer, size) -> bytes written
+#define SYS_MMAP   10 // (handle, offset, length, flags) -> address or 0
+#define SYS_MUNMAP 11 // (address)
+
 void init_syscalls();
 
 #endif
@@ -4,6 +4,8 @@
 #include "../libc/function.h"
 
 uint32_t tick = 0;
+static uint32_t timer_freq = 0;
+static uint32_t tsc_per_ms = 0;
 
 static void timer_callback(registers_t *regs) {
     tick++;
@@ -14,6 +16,8 @@ void init_timer(uint32_t freq) {
     /* Install the function we just wrote */
     register_interrupt_handler(IRQ0, timer_callback);
 
+    timer_freq = freq;
+
     /* Get the PIT value: hardware clock at 1193180 Hz */
     uint32_t divisor = 1193180 / freq;
     uint8_t low  = (uint8_t)(divisor & 0xFF);
@@ -24,3 +28,29 @@ void init_timer(uint32_t freq) {
     port_byte_out(0x40, high);
 }
 
+/* Measure the TSC rate against the PIT. Must run with interrupts on:
+ * shell commands run inside the keyboard handler, where the timer does
+ * not tick, so they time themselves with rdtsc() instead. */
+void timer_calibrate() {
+    uint32_t start = tick;
+    while (tick == start) asm volatile("hlt" ::: "memory");
+
+    uint64_t begin = rdtsc();
+    start = tick;
+    while (tick - start < 5) asm volatile("hlt" ::: "memory");
+    uint64_t cycles = rdtsc() - begin;
+
+    tsc_per_ms = udiv64(cycles * timer_freq, 5 * 1000);
+}
+
+/* Milliseconds since the timer started, as counted by its ticks */
+uint32_t timer_ms() {
+    if (timer_freq == 0) return 0;
+    uint32_t t = tick;
+    return (t / timer_freq) * 1000 + (t % timer_freq) * 1000 / timer_freq;
+}
+
+uint32_t timer_cycles_to_us(uint64_t cycles) {
+    if (tsc_per_ms == 0) return 0;
+    return udiv64(cycles * 1000, tsc_per_ms);
+}
@@ -3,6 +3,18 @@
 
 #include <stdint.h>
 
+extern uint32_t tick;
+
 void init_timer(uint32_t freq);
+void timer_calibrate();
+uint32_t timer_ms();
+uint32_t timer_cycles_to_us(uint64_t cycles);
+
+/* CPU cycle counter, for timing code that runs with interrupts off */
+static inline uint64_t rdtsc() {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
 
 #endif
@@ -22,9 +22,24 @@ jump_to_user_mode:
     mov eax, 0 ; Syscall 0: print
     mov ebx, .msg
     int 0x80
+
+    ; Append the same line to user.log in the current directory
+    mov eax, 2 ; Syscall 2: open
+    mov ebx, .log
+    mov ecx, 0x16 ; O_WRITE | O_CREATE | O_APPEND
+    int 0x80
+    mov ebx, eax ; Handle
+    mov eax, 9 ; Syscall 9: append
+    mov ecx, .msg
+    mov edx, .msg_len
+    int 0x80
+    mov eax, 3 ; Syscall 3: close
+    int 0x80
     
     mov eax, 1 ; Syscall 1: exit
     int 0x80
     jmp $ ; Should not be reached
 
 .msg db "Hello from User Mode!", 0x0A, 0
+.msg_len equ $ - .msg - 1
+.log db "user.log", 0
@@ -0,0 +1,190 @@
+#include "ata.h"
+#include "../cpu/ports.h"
+#include "../cpu/isr.h"
+#include "../libc/function.h"
+#include <stdint.h>
+#include <stddef.h>
+
+static uint8_t present = 0;
+static uint32_t sectors = 0;
+
+/* The request currently owning the bus, NULL when idle */
+static ata_request_t *current = NULL;
+
+/* Reading the alternate status 4 times gives the drive the 400ns
+ * it needs to update BSY/DRQ after a command or a sector transfer */
+static uint8_t ata_delay() {
+    port_byte_in(ATA_REG_CONTROL);
+    port_byte_in(ATA_REG_CONTROL);
+    port_byte_in(ATA_REG_CONTROL);
+    return port_byte_in(ATA_REG_CONTROL);
+}
+
+static void ata_select(uint32_t lba, uint16_t count) {
+    port_byte_out(ATA_REG_DRIVE, 0xE0 | ((lba >> 24) & 0x0F)); /* Master, LBA mode */
+    port_byte_out(ATA_REG_COUNT, (uint8_t)count); /* 256 is sent as 0 */
+    port_byte_out(ATA_REG_LBA_LOW, (uint8_t)lba);
+    port_byte_out(ATA_REG_LBA_MID, (uint8_t)(lba >> 8));
+    port_byte_out(ATA_REG_LBA_HIGH, (uint8_t)(lba >> 16));
+}
+
+static void ata_finish(uint8_t state) {
+    ata_request_t *req = current;
+    current = NULL;
+    req->state = state;
+    if (req->complete) req->complete(req);
+}
+
+/**
+ * Advance the in-flight request as far as the drive allows without
+ * blocking. Called from the IRQ14 handler, and by anyone waiting on a
+ * request, since the shell runs inside the keyboard IRQ where IRQ14
+ * cannot be delivered.
+ */
+void ata_poll() {
+    uint32_t flags = irq_save();
+    ata_request_t *req = current;
+
+    while (req && current == req) {
+        uint8_t status = port_byte_in(ATA_REG_STATUS);
+        if (status & ATA_SR_BSY) break;
+
+        if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+            ata_finish(ATA_REQ_ERROR);
+            break;
+        }
+
+        if (req->done == req->count) {
+            /* Writes end once the drive has swallowed the last sector */
+            ata_finish(ATA_REQ_DONE);
+            break;
+        }
+
+        if (!(status & ATA_SR_DRQ)) break;
+
+        uint8_t *buf = req->sector_buffer(req, req->done);
+        if (req->write) {
+            port_words_out(ATA_REG_DATA, buf, ATA_SECTOR_SIZE / 2);
+        } else {
+            port_words_in(ATA_REG_DATA, buf, ATA_SECTOR_SIZE / 2);
+        }
+        req->done++;
+        ata_delay();
+
+        if (!req->write && req->done == req->count) {
+            ata_finish(ATA_REQ_DONE);
+            break;
+        }
+    }
+
+    irq_restore(flags);
+}
+
+static void ata_callback(registers_t *regs) {
+    ata_poll();
+    UNUSED(regs);
+}
+
+int ata_wait(ata_request_t *req) {
+    while (req->state == ATA_REQ_PENDING) ata_poll();
+    return req->state == ATA_REQ_DONE ? 0 : -1;
+}
+
+int ata_submit(ata_request_t *req) {
+    if (!present || req->count == 0 || req->count > ATA_MAX_SECTORS) return -1;
+    if (req->lba + req->count > sectors) return -1;
+
+    while (current) ata_poll();
+
+    uint32_t flags = irq_save();
+    req->done = 0;
+    req->state = ATA_REQ_PENDING;
+    current = req;
+
+    ata_select(req->lba, req->count);
+    port_byte_out(ATA_REG_COMMAND, req->write ? ATA_CMD_WRITE : ATA_CMD_READ);
+    ata_delay();
+    irq_restore(flags);
+
+    /* Writes get no interrupt for the first sector: feed it as soon
+     * as the drive asks, the rest are pushed as it raises IRQ14 */
+    if (req->write) {
+        while (ata_delay() & ATA_SR_BSY);
+        ata_poll();
+    }
+    return 0;
+}
+
+static uint8_t *ata_linear_buffer(ata_request_t *req, uint16_t sector) {
+    return (uint8_t*)req->private + sector * ATA_SECTOR_SIZE;
+}
+
+static int ata_transfer(uint32_t lba, uint16_t count, uint8_t *buffer, uint8_t write) {
+    ata_request_t req;
+    req.lba = lba;
+    req.count = count;
+    req.write = write;
+    req.sector_buffer = ata_linear_buffer;
+    req.complete = NULL;
+    req.private = buffer;
+    if (ata_submit(&req) != 0) return -1;
+    return ata_wait(&req);
+}
+
+int ata_read(uint32_t lba, uint16_t count, uint8_t *buffer) {
+    return ata_transfer(lba, count, buffer, 0);
+}
+
+int ata_write(uint32_t lba, uint16_t count, uint8_t *buffer) {
+    return ata_transfer(lba, count, buffer, 1);
+}
+
+/* Ask the drive to commit its write cache to the media */
+int ata_flush() {
+    if (!present) return -1;
+    while (current) ata_poll();
+
+    port_byte_out(ATA_REG_DRIVE, 0xE0);
+    port_byte_out(ATA_REG_COMMAND, ATA_CMD_FLUSH);
+    uint8_t status = ata_delay();
+    while (status & ATA_SR_BSY) status = port_byte_in(ATA_REG_STATUS);
+    return (status & (ATA_SR_ERR | ATA_SR_DF)) ? -1 : 0;
+}
+
+uint8_t ata_present() {
+    return present;
+}
+
+uint32_t ata_sector_count() {
+    return sectors;
+}
+
+void init_ata() {
+    /* A floating bus reads as 0xFF: no controller at all */
+    if (port_byte_in(ATA_REG_STATUS) == 0xFF) return;
+
+    port_byte_out(ATA_REG_DRIVE, 0xA0);
+    ata_delay();
+    ata_select(0, 0);
+    port_byte_out(ATA_REG_DRIVE, 0xA0);
+    port_byte_out(ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+    uint8_t status = port_byte_in(ATA_REG_STATUS);
+    if (status == 0) return; /* No drive attached */
+    while (status & ATA_SR_BSY) status = port_byte_in(ATA_REG_STATUS);
+
+    /* ATAPI and SATA devices put a signature here: not a plain disk */
+    if (port_byte_in(ATA_REG_LBA_MID) || port_byte_in(ATA_REG_LBA_HIGH)) return;
+
+    while (!(status & (ATA_SR_DRQ | ATA_SR_ERR))) status = port_byte_in(ATA_REG_STATUS);
+    if (status & ATA_SR_ERR) return;
+
+    uint16_t identify[256];
+    port_words_in(ATA_REG_DATA, identify, 256);
+    sectors = identify[60] | ((uint32_t)identify[61] << 16); /* LBA28 capacity */
+    if (sectors == 0) return;
+
+    present = 1;
+    register_interrupt_handler(IRQ14, ata_callback);
+    port_byte_out(ATA_REG_CONTROL, 0x00); /* Clear nIEN: we want IRQ14 */
+}
@@ -0,0 +1,70 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include <stdint.h>
+
+#define ATA_SECTOR_SIZE 512
+#define ATA_MAX_SECTORS 256 /* Largest transfer a single LBA28 command can do */
+
+/* Primary bus i/o ports */
+#define ATA_REG_DATA     0x1F0
+#define ATA_REG_ERROR    0x1F1
+#define ATA_REG_COUNT    0x1F2
+#define ATA_REG_LBA_LOW  0x1F3
+#define ATA_REG_LBA_MID  0x1F4
+#define ATA_REG_LBA_HIGH 0x1F5
+#define ATA_REG_DRIVE    0x1F6
+#define ATA_REG_STATUS   0x1F7 /* Reading it acknowledges the IRQ */
+#define ATA_REG_COMMAND  0x1F7
+#define ATA_REG_CONTROL  0x3F6 /* Reads give the 'alternate status' */
+
+#define ATA_SR_ERR  0x01
+#define ATA_SR_DRQ  0x08
+#define ATA_SR_DF   0x20
+#define ATA_SR_BSY  0x80
+
+#define ATA_CMD_READ     0x20
+#define ATA_CMD_WRITE    0x30
+#define ATA_CMD_FLUSH    0xE7
+#define ATA_CMD_IDENTIFY 0xEC
+
+typedef enum {
+    ATA_REQ_IDLE,
+    ATA_REQ_PENDING,
+    ATA_REQ_DONE,
+    ATA_REQ_ERROR
+} ata_req_state_t;
+
+/* A single transfer of 'count' contiguous sectors starting at 'lba'.
+ * The driver does not need the data to be contiguous in memory: it
+ * asks 'sector_buffer' where each sector lives, so callers can
+ * scatter one command over several cache buffers.
+ * 'complete' (optional) runs once the request is done, possibly from
+ * the IRQ14 handler. */
+typedef struct ata_request {
+    uint32_t lba;
+    uint16_t count;
+    uint16_t done;
+    uint8_t write;
+    volatile uint8_t state;
+    uint8_t *(*sector_buffer)(struct ata_request *req, uint16_t sector);
+    void (*complete)(struct ata_request *req);
+    void *private;
+} ata_request_t;
+
+void init_ata();
+uint8_t ata_present();
+uint32_t ata_sector_count();
+
+/* Asynchronous interface: only one request is in flight at a time,
+ * submitting while the bus is busy first waits for the previous one */
+int ata_submit(ata_request_t *req);
+void ata_poll();
+int ata_wait(ata_request_t *req);
+
+/* Synchronous helpers for contiguous buffers */
+int ata_read(uint32_t lba, uint16_t count, uint8_t *buffer);
+int ata_write(uint32_t lba, uint16_t count, uint8_t *buffer);
+int ata_flush();
+
+#endif
@@ -0,0 +1,177 @@
+#include "fb.h"
+#include "../cpu/ports.h"
+#include "../cpu/paging.h"
+#include "../libc/mem.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Graphics console on the linear framebuffer of the Bochs VBE adapter.
+ * It draws the same character cells as text mode: the screen code
+ * keeps the cells and hands over the spans that changed.
+ *
+ * Characters are drawn with the 8x16 font the BIOS loaded for text
+ * mode. Each (character, attribute) pair is expanded to pixels once
+ * and kept in a direct-mapped cache, so drawing a cell is 16 copies
+ * of 32 bytes. Runs of blanks are filled a scanline at a time. */
+
+typedef struct {
+    uint16_t cell;  /* Character in the low byte, attribute in the high one */
+    uint16_t valid;
+    uint32_t pixels[FONT_HEIGHT * FONT_WIDTH];
+} glyph_t;
+
+static const uint32_t palette[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF
+};
+
+static uint32_t *fb = NULL;
+static uint8_t font[256 * FONT_HEIGHT];
+static glyph_t *glyphs = NULL;
+
+static uint16_t vbe_read(uint16_t index) {
+    port_word_out(VBE_DISPI_INDEX, index);
+    return port_word_in(VBE_DISPI_DATA);
+}
+
+static void vbe_write(uint16_t index, uint16_t value) {
+    port_word_out(VBE_DISPI_INDEX, index);
+    port_word_out(VBE_DISPI_DATA, value);
+}
+
+static uint32_t pci_read(uint8_t bus, uint8_t dev, uint8_t reg) {
+    port_dword_out(PCI_CONFIG_ADDRESS, 0x80000000 | (bus << 16) | (dev << 11) | (reg & 0xFC));
+    return port_dword_in(PCI_CONFIG_DATA);
+}
+
+/* Physical address of the framebuffer: BAR0 of the adapter */
+static uint32_t find_lfb() {
+    for (uint8_t dev = 0; dev < 32; dev++) {
+        if (pci_read(0, dev, 0) == ((VBE_PCI_DEVICE << 16) | VBE_PCI_VENDOR)) {
+            return pci_read(0, dev, 0x10) & ~0xF;
+        }
+    }
+    return 0;
+}
+
+/* The font is in plane 2 of video memory, one glyph every 32 bytes.
+ * Map that plane alone at 0xA0000 to copy it, then restore text mode
+ * addressing. */
+static void read_font() {
+    port_word_out(VGA_SEQ_INDEX, 0x0402); /* Write plane 2 */
+    port_word_out(VGA_SEQ_INDEX, 0x0704); /* Sequential addressing */
+    port_word_out(VGA_GC_INDEX, 0x0204);  /* Read plane 2 */
+    port_word_out(VGA_GC_INDEX, 0x0005);  /* No odd/even */
+    port_word_out(VGA_GC_INDEX, 0x0406);  /* 64 KiB at 0xA0000 */
+
+    volatile uint8_t *plane = (volatile uint8_t*)0xA0000;
+    for (int c = 0; c < 256; c++) {
+        for (int y = 0; y < FONT_HEIGHT; y++) font[c * FONT_HEIGHT + y] = plane[c * 32 + y];
+    }
+
+    port_word_out(VGA_SEQ_INDEX, 0x0302);
+    port_word_out(VGA_SEQ_INDEX, 0x0304);
+    port_word_out(VGA_GC_INDEX, 0x0004);
+    port_word_out(VGA_GC_INDEX, 0x1005);
+    port_word_out(VGA_GC_INDEX, 0x0E06);
+}
+
+/**
+ * Switch to FB_WIDTH x FB_HEIGHT x 32 if the adapter is there. Needs
+ * paging, to map the framebuffer. Returns -1 and stays in text mode
+ * otherwise.
+ */
+int fb_init() {
+    if (vbe_read(VBE_DISPI_ID) < VBE_DISPI_ID4) return -1;
+    uint32_t lfb = find_lfb();
+    if (!lfb) return -1;
+
+    glyphs = (glyph_t*)kmalloc(GLYPH_CACHE_SIZE * sizeof(glyph_t), 0, NULL);
+    if (!glyphs) return -1;
+    for (int i = 0; i < GLYPH_CACHE_SIZE; i++) glyphs[i].valid = 0;
+
+    for (uint32_t off = 0; off < FB_WIDTH * FB_HEIGHT * 4; off += PAGE_SIZE) {
+        if (paging_map(lfb + off, lfb + off, PAGE_WRITE) != 0) {
+            kfree((uint32_t)glyphs);
+            glyphs = NULL;
+            return -1;
+        }
+    }
+
+    read_font();
+    vbe_write(VBE_DISPI_ENABLE, 0);
+    vbe_write(VBE_DISPI_XRES, FB_WIDTH);
+    vbe_write(VBE_DISPI_YRES, FB_HEIGHT);
+    vbe_write(VBE_DISPI_BPP, FB_BPP);
+    vbe_write(VBE_DISPI_ENABLE, VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED);
+    fb = (uint32_t*)lfb;
+    return 0;
+}
+
+uint8_t fb_active() {
+    return fb != NULL;
+}
+
+static uint32_t *cell_pixels(int col, int row) {
+    return fb + row * FONT_HEIGHT * FB_WIDTH + col * FONT_WIDTH;
+}
+
+static glyph_t *glyph_get(uint16_t cell) {
+    uint32_t c = cell & 0xFF;
+    uint32_t attr = cell >> 8;
+    glyph_t *g = &glyphs[(attr * 67 + c) % GLYPH_CACHE_SIZE];
+    if (g->valid && g->cell == cell) return g;
+
+    uint32_t fg = palette[attr & 0xF];
+    uint32_t bg = palette[attr >> 4];
+    uint8_t *bits = &font[c * FONT_HEIGHT];
+    for (int y = 0; y < FONT_HEIGHT; y++) {
+        for (int x = 0; x < FONT_WIDTH; x++) {
+            g->pixels[y * FONT_WIDTH + x] = (bits[y] & (0x80 >> x)) ? fg : bg;
+        }
+    }
+    g->cell = cell;
+    g->valid = 1;
+    return g;
+}
+
+/* Fill 'width' x 'height' pixels from 'dst', one span per scanline */
+static void fill_rect(uint32_t *dst, int width, int height, uint32_t color) {
+    for (int y = 0; y < height; y++, dst += FB_WIDTH) memory_set32(dst, color, width);
+}
+
+/* Draw 'count' text cells (character, attribute) from column 'col' of 'row' */
+void fb_draw_cells(int col, int row, uint16_t *cells, int count) {
+    int i = 0;
+    while (i < count) {
+        uint16_t cell = cells[i];
+        uint8_t c = cell & 0xFF;
+
+        if (c == ' ' || c == 0) {
+            int n = 1;
+            while (i + n < count && cells[i + n] == cell) n++;
+            fill_rect(cell_pixels(col + i, row), n * FONT_WIDTH, FONT_HEIGHT, palette[cell >> 12]);
+            i += n;
+            continue;
+        }
+
+        glyph_t *g = glyph_get(cell);
+        uint32_t *dst = cell_pixels(col + i, row);
+        for (int y = 0; y < FONT_HEIGHT; y++, dst += FB_WIDTH) {
+            memory_copy((uint8_t*)&g->pixels[y * FONT_WIDTH], (uint8_t*)dst, FONT_WIDTH * 4);
+        }
+        i++;
+    }
+}
+
+/* Move text rows 'lines'..'rows' up to the top. The rows left at the
+ * bottom are stale until drawn again. */
+void fb_scroll(int lines, int rows) {
+    uint32_t row_pixels = FB_WIDTH * FONT_HEIGHT;
+    memory_copy((uint8_t*)(fb + lines * row_pixels), (uint8_t*)fb, (rows - lines) * row_pixels * 4);
+}
+
+/* Underline the cell at 'col', 'row' in the foreground color of 'attr' */
+void fb_draw_cursor(int col, int row, uint8_t attr) {
+    fill_rect(cell_pixels(col, row) + (FONT_HEIGHT - 2) * FB_WIDTH, FONT_WIDTH, 2, palette[attr & 0xF]);
+}
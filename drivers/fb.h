@@ -0,0 +1,45 @@
+#ifndef FB_H
+#define FB_H
+
+#include <stdint.h>
+
+/* Mode set on the Bochs/QEMU VBE adapter (-vga std) */
+#define FB_WIDTH 1024
+#define FB_HEIGHT 768
+#define FB_BPP 32
+
+#define FONT_WIDTH 8
+#define FONT_HEIGHT 16
+#define FB_COLS (FB_WIDTH / FONT_WIDTH)
+#define FB_ROWS (FB_HEIGHT / FONT_HEIGHT)
+
+#define GLYPH_CACHE_SIZE 512 /* Rendered (character, attribute) pairs */
+
+/* Bochs VBE "DISPI" interface */
+#define VBE_DISPI_INDEX 0x01CE
+#define VBE_DISPI_DATA  0x01CF
+#define VBE_DISPI_ID     0
+#define VBE_DISPI_XRES   1
+#define VBE_DISPI_YRES   2
+#define VBE_DISPI_BPP    3
+#define VBE_DISPI_ENABLE 4
+#define VBE_DISPI_ID4    0xB0C4 /* First version with 32 bpp */
+#define VBE_DISPI_ENABLED     0x01
+#define VBE_DISPI_LFB_ENABLED 0x40
+
+#define VBE_PCI_VENDOR 0x1234
+#define VBE_PCI_DEVICE 0x1111
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+/* VGA sequencer and graphics controller, to read the text mode font */
+#define VGA_SEQ_INDEX 0x3C4
+#define VGA_GC_INDEX  0x3CE
+
+int fb_init();
+uint8_t fb_active();
+void fb_draw_cells(int col, int row, uint16_t *cells, int count);
+void fb_scroll(int lines, int rows);
+void fb_draw_cursor(int col, int row, uint8_t attr);
+
+#endif
@@ -1,12 +1,16 @@
 #include "keyboard.h"
 #include "../cpu/ports.h"
 #include "../cpu/isr.h"
+#include "screen.h"
 #include "../kernel/input.h"
 #include <stdint.h>
 
 static void keyboard_callback(registers_t *regs) {
     uint8_t scancode = port_byte_in(0x60);
+    // Whatever the key prints reaches the screen in one flush
+    screen_begin();
     input_handle_scancode(scancode);
+    screen_end();
     (void)regs;
 }
 
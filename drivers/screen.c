@@ -1,6 +1,10 @@
 #include "screen.h"
+#include "serial.h"
+#include "fb.h"
 #include "../cpu/ports.h"
 #include "../libc/mem.h"
+#include "../libc/string.h"
+#include "../libc/printf.h"
 #include <stdint.h>
 #include <stddef.h>
 
@@ -8,9 +12,50 @@
 void set_cursor_offset(int offset);
 int print_char(char c, int col, int row, char attr);
 int get_offset(int col, int row);
+static void screen_flush();
+static uint8_t *screen_row(int row);
+static void mark_dirty(int row, int lo, int hi);
+static void mark_all();
 
 static int backspace_limit = 0;
 
+/* Everything is drawn into a ring of lines in RAM, which also keeps
+ * the scrollback. Rows that changed are copied to video memory, and
+ * the hardware cursor moved, when the outermost print call returns, or
+ * at screen_end() if the caller batches several of them: port I/O and
+ * video memory are slow.
+ *
+ * Video memory holds VRAM_ROWS rows and the CRTC shows TEXT_ROWS of
+ * them from 'vram_top'. Scrolling moves the ring and that start
+ * address by one line, so only the new bottom row is copied. When the
+ * window reaches the end of video memory it starts over at the top.
+ *
+ * On the framebuffer the console is bigger, and the rows are drawn as
+ * pixels by fb.c. Only the span of each row that changed is drawn, and
+ * the lines scrolled since the last flush are moved up with one blit.
+ *
+ * Text printed at the cursor is also copied to the serial console.
+ * Text placed at fixed positions (the editor) is not. */
+static uint8_t fallback[MAX_ROWS * ROW_BYTES] __attribute__((aligned(4)));
+static uint8_t *lines = NULL;         /* Ring of 'line_capacity' rows */
+static uint32_t line_capacity = 0;
+static uint32_t screen_first = 0;     /* Ring line shown on screen row 0 */
+static uint32_t line_count = TEXT_ROWS; /* Lines of the ring holding text */
+static uint32_t view_back = 0;        /* How far the view is scrolled back */
+static int rows = TEXT_ROWS;
+static int cols = TEXT_COLS;
+
+static uint64_t dirty_rows = 0; /* One bit per screen row */
+static uint8_t dirty_lo[MAX_ROWS]; /* Columns that changed in each of them */
+static uint8_t dirty_hi[MAX_ROWS];
+static int vram_top = 0;
+static int hw_top = -1;         /* What the CRTC start address is */
+static int scroll_pending = 0;  /* Lines the framebuffer must be moved up */
+static int cursor = 0;          /* Offset of the cursor */
+static int hw_cursor = -1;      /* Where the cursor is drawn, in cells */
+static int batch_depth = 0;
+static screen_output_t redirect = NULL; /* Set by the shell for pipes and files */
+
 /**********************************************************
  * Public Kernel API functions                            *
  **********************************************************/
@@ -19,6 +64,23 @@ void set_backspace_limit(int limit) {
     backspace_limit = limit;
 }
 
+/* Send what would be printed at the cursor to 'output' instead, or
+ * back to the screen when it is NULL. Text at a given place is still
+ * drawn: the editor and the pager own the screen. */
+void screen_redirect(screen_output_t output) {
+    redirect = output;
+}
+
+/* Group the output up to the matching screen_end() into one flush */
+void screen_begin() {
+    batch_depth++;
+}
+
+void screen_end() {
+    if (batch_depth > 0) batch_depth--;
+    if (batch_depth == 0) screen_flush();
+}
+
 /**
  * Print a message on the specified location
  * If col, row, are negative, we will use the current offset
@@ -32,9 +94,15 @@ void kprint_at(char *message, int col, int row) {
         offset = get_cursor_offset();
         row = get_offset_row(offset);
         col = get_offset_col(offset);
+        if (redirect) {
+            redirect(message, strlen(message));
+            return;
+        }
+        serial_write(message, strlen(message));
     }
 
     /* Loop through message and print it */
+    screen_begin();
     size_t i = 0;
     while (message[i] != 0) {
         offset = print_char(message[i++], col, row, WHITE_ON_BLACK);
@@ -42,14 +110,50 @@ void kprint_at(char *message, int col, int row) {
         row = get_offset_row(offset);
         col = get_offset_col(offset);
     }
+    screen_end();
 }
 
 void kprint(char *message) {
     kprint_at(message, -1, -1);
 }
 
+/* Print exactly 'len' bytes, for text that is not NUL terminated */
+void kprint_len(char *message, uint32_t len) {
+    if (redirect) {
+        redirect(message, len);
+        return;
+    }
+    int offset = get_cursor_offset();
+    int row = get_offset_row(offset);
+    int col = get_offset_col(offset);
+    serial_write(message, len);
+
+    screen_begin();
+    for (uint32_t i = 0; i < len; i++) {
+        offset = print_char(message[i], col, row, WHITE_ON_BLACK);
+        row = get_offset_row(offset);
+        col = get_offset_col(offset);
+    }
+    screen_end();
+}
+
+/* Format into a buffer on the stack, which keeps it safe to use from
+ * an interrupt handler, and print the result in one go. Output longer
+ * than KPRINTF_BUFFER is cut short. Returns the full length. */
+int kprintf(const char *fmt, ...) {
+    char buffer[KPRINTF_BUFFER];
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    kprint_len(buffer, len < (int)sizeof(buffer) ? len : (int)sizeof(buffer) - 1);
+    return len;
+}
+
 void kprint_char_at(char c, int col, int row, char attr) {
+    screen_begin();
     print_char(c, col, row, attr);
+    screen_end();
 }
 
 void kprint_backspace() {
@@ -58,7 +162,10 @@ void kprint_backspace() {
         offset -= 2;
         int row = get_offset_row(offset);
         int col = get_offset_col(offset);
+        serial_write("\b \b", 3);
+        screen_begin();
         print_char(0x08, col, row, WHITE_ON_BLACK);
+        screen_end();
     }
 }
 
@@ -68,78 +175,226 @@ void kprint_backspace() {
  **********************************************************/
 
 
+static void crtc_write(uint8_t reg, uint16_t value) {
+    port_byte_out(REG_SCREEN_CTRL, reg);
+    port_byte_out(REG_SCREEN_DATA, (uint8_t)(value >> 8));
+    port_byte_out(REG_SCREEN_CTRL, reg + 1);
+    port_byte_out(REG_SCREEN_DATA, (uint8_t)(value & 0xff));
+}
+
+static void blank_row(uint8_t *row) {
+    uint16_t *cells = (uint16_t*) row;
+    for (int i = 0; i < MAX_COLS; i++) cells[i] = (WHITE_ON_BLACK << 8) | ' ';
+}
+
+/* Allocate the scrollback, or make do with a single screen */
+static void lines_init() {
+    if (lines) return;
+    lines = (uint8_t*) kmalloc(SCROLLBACK_LINES * ROW_BYTES, 0, NULL);
+    line_capacity = SCROLLBACK_LINES;
+    if (!lines) {
+        lines = fallback;
+        line_capacity = MAX_ROWS;
+    }
+    for (int row = 0; row < rows; row++) blank_row(screen_row(row));
+}
+
+static uint8_t *ring_line(uint32_t index) {
+    return &lines[(index % line_capacity) * ROW_BYTES];
+}
+
+static uint8_t *screen_row(int row) {
+    return ring_line(screen_first + row);
+}
+
+/* Columns 'lo' to 'hi' of 'row' must be redrawn */
+static void mark_dirty(int row, int lo, int hi) {
+    uint64_t bit = (uint64_t)1 << row;
+    if (!(dirty_rows & bit)) {
+        dirty_rows |= bit;
+        dirty_lo[row] = lo;
+        dirty_hi[row] = hi;
+        return;
+    }
+    if (lo < dirty_lo[row]) dirty_lo[row] = lo;
+    if (hi > dirty_hi[row]) dirty_hi[row] = hi;
+}
+
+static void mark_all() {
+    for (int row = 0; row < rows; row++) {
+        dirty_lo[row] = 0;
+        dirty_hi[row] = cols - 1;
+    }
+    dirty_rows = ((uint64_t)1 << rows) - 1;
+}
+
+/* Show 'back' lines above the screen: every row must be redrawn */
+static void set_view(uint32_t back) {
+    if (back == view_back) return;
+    view_back = back;
+    mark_all();
+}
+
+/* Start a new line at the bottom of the screen */
+static void scroll_line() {
+    screen_first = (screen_first + 1) % line_capacity;
+    if (line_count < line_capacity) line_count++;
+    blank_row(screen_row(rows - 1));
+
+    /* What was drawn moves up with the start address, or with the
+     * blit at the next flush */
+    dirty_rows >>= 1;
+    for (int row = 0; row < rows - 1; row++) {
+        dirty_lo[row] = dirty_lo[row + 1];
+        dirty_hi[row] = dirty_hi[row + 1];
+    }
+    mark_dirty(rows - 1, 0, cols - 1);
+
+    if (fb_active()) {
+        if (scroll_pending < rows) scroll_pending++;
+    } else if (++vram_top + rows > VRAM_ROWS) {
+        vram_top = 0;
+        mark_all();
+    }
+}
+
+/* Copy the changed spans to video memory and point the CRTC at them
+ * if it is not already */
+static void text_flush(uint32_t first_line) {
+    uint16_t *vidmem = (uint16_t*) VIDEO_ADDRESS;
+    for (int row = 0; row < rows; row++) {
+        if (!(dirty_rows & ((uint64_t)1 << row))) continue;
+        uint8_t *src = ring_line(first_line + row) + dirty_lo[row] * 2;
+        uint16_t *dst = vidmem + (vram_top + row) * TEXT_COLS + dirty_lo[row];
+        memory_copy(src, (uint8_t*)dst, (dirty_hi[row] - dirty_lo[row] + 1) * 2);
+    }
+
+    if (vram_top != hw_top) {
+        crtc_write(REG_START_ADDRESS, vram_top * TEXT_COLS);
+        hw_top = vram_top;
+    }
+
+    /* While looking back the cursor is parked below the screen */
+    int position = vram_top * TEXT_COLS + (view_back ? rows * TEXT_COLS : cursor / 2);
+    if (position != hw_cursor) {
+        crtc_write(REG_CURSOR, position);
+        hw_cursor = position;
+    }
+}
+
+/* Blit up the lines scrolled, draw the changed spans, and move the
+ * cursor, which is drawn over its cell */
+static void fb_flush(uint32_t first_line) {
+    int old = hw_cursor;
+    if (scroll_pending) {
+        /* Not worth it if every row is drawn anyway */
+        if (dirty_rows != ((uint64_t)1 << rows) - 1) fb_scroll(scroll_pending, rows);
+        if (old >= 0) old -= scroll_pending * cols;
+        scroll_pending = 0;
+    }
+
+    int position = view_back || cursor / 2 >= rows * cols ? -1 : cursor / 2;
+    if (old >= 0 && old != position) mark_dirty(old / cols, old % cols, old % cols);
+
+    for (int row = 0; row < rows; row++) {
+        if (!(dirty_rows & ((uint64_t)1 << row))) continue;
+        uint16_t *cells = (uint16_t*) ring_line(first_line + row);
+        fb_draw_cells(dirty_lo[row], row, cells + dirty_lo[row], dirty_hi[row] - dirty_lo[row] + 1);
+    }
+
+    if (position >= 0) {
+        uint16_t cell = ((uint16_t*) screen_row(position / cols))[position % cols];
+        fb_draw_cursor(position % cols, position / cols, cell >> 8);
+    }
+    hw_cursor = position;
+}
+
+static void screen_flush() {
+    if (!lines) return;
+
+    uint32_t first_line = screen_first + line_capacity - view_back;
+    if (fb_active()) fb_flush(first_line);
+    else text_flush(first_line);
+    dirty_rows = 0;
+}
+
+/**
+ * Move the view 'lines' lines back into the scrollback (or forward if
+ * negative), without going past the oldest line or below the screen
+ */
+void screen_scroll_view(int lines_back) {
+    lines_init();
+    int back = (int)view_back + lines_back;
+    int max = line_count - rows;
+    if (back > max) back = max;
+    if (back < 0) back = 0;
+    set_view(back);
+    if (batch_depth == 0) screen_flush();
+}
+
 /**
- * Innermost print function for our kernel, directly accesses the video memory 
+ * Innermost print function for our kernel, draws into the line ring
  *
  * If 'col' and 'row' are negative, we will print at current cursor location
  * If 'attr' is zero it will use 'white on black' as default
  * Returns the offset of the next character
- * Sets the video cursor to the returned offset
+ * Sets the cursor to the returned offset
  */
 int print_char(char c, int col, int row, char attr) {
-    uint8_t *vidmem = (uint8_t*) VIDEO_ADDRESS;
     if (!attr) attr = WHITE_ON_BLACK;
+    lines_init();
+
+    /* New output brings the view back down */
+    set_view(0);
 
     /* Error control: print a red 'E' if the coords aren't right */
-    if (col >= MAX_COLS || row >= MAX_ROWS) {
-        vidmem[2*(MAX_COLS)*(MAX_ROWS)-2] = 'E';
-        vidmem[2*(MAX_COLS)*(MAX_ROWS)-1] = RED_ON_WHITE;
+    if (col >= cols || row >= rows) {
+        uint8_t *last = screen_row(rows - 1);
+        last[2 * cols - 2] = 'E';
+        last[2 * cols - 1] = RED_ON_WHITE;
+        mark_dirty(rows - 1, cols - 1, cols - 1);
         return get_offset(col, row);
     }
 
     int offset;
     if (col >= 0 && row >= 0) offset = get_offset(col, row);
-    else offset = get_cursor_offset();
+    else offset = cursor;
 
+    row = get_offset_row(offset);
+    uint8_t *cell = screen_row(row) + offset - get_offset(0, row);
     if (c == '\n') {
-        row = get_offset_row(offset);
         offset = get_offset(0, row+1);
     } else if (c == 0x08) { /* Backspace */
-        vidmem[offset] = ' ';
-        vidmem[offset+1] = attr;
+        cell[0] = ' ';
+        cell[1] = attr;
+        mark_dirty(row, get_offset_col(offset), get_offset_col(offset));
     } else {
-        vidmem[offset] = c;
-        vidmem[offset+1] = attr;
+        /* A cell rewritten with what it holds needs no redraw */
+        if (cell[0] != (uint8_t)c || cell[1] != (uint8_t)attr) {
+            cell[0] = c;
+            cell[1] = attr;
+            mark_dirty(row, get_offset_col(offset), get_offset_col(offset));
+        }
         offset += 2;
     }
 
     /* Check if the offset is over screen size and scroll */
-    if (offset >= MAX_ROWS * MAX_COLS * 2) {
-        for (size_t i = 1; i < MAX_ROWS; i++) 
-            memory_copy((uint8_t*)(get_offset(0, i) + VIDEO_ADDRESS),
-                        (uint8_t*)(get_offset(0, i-1) + VIDEO_ADDRESS),
-                        MAX_COLS * 2);
-
-        /* Blank last line */
-        char *last_line = (char*) (get_offset(0, MAX_ROWS-1) + (uint8_t*) VIDEO_ADDRESS);
-        for (size_t i = 0; i < MAX_COLS * 2; i++) last_line[i] = 0;
-
-        offset -= 2 * MAX_COLS;
+    if (offset >= rows * cols * 2) {
+        scroll_line();
+        offset -= 2 * cols;
     }
 
-    set_cursor_offset(offset);
+    cursor = offset;
     return offset;
 }
 
 int get_cursor_offset() {
-    /* Use the VGA ports to get the current cursor position
-     * 1. Ask for high byte of the cursor offset (data 14)
-     * 2. Ask for low byte (data 15)
-     */
-    port_byte_out(REG_SCREEN_CTRL, 14);
-    int offset = port_byte_in(REG_SCREEN_DATA) << 8; /* High byte: << 8 */
-    port_byte_out(REG_SCREEN_CTRL, 15);
-    offset += port_byte_in(REG_SCREEN_DATA);
-    return offset * 2; /* Position * size of character cell */
+    return cursor;
 }
 
 void set_cursor_offset(int offset) {
-    /* Similar to get_cursor_offset, but instead of reading we write data */
-    offset /= 2;
-    port_byte_out(REG_SCREEN_CTRL, 14);
-    port_byte_out(REG_SCREEN_DATA, (uint8_t)(offset >> 8));
-    port_byte_out(REG_SCREEN_CTRL, 15);
-    port_byte_out(REG_SCREEN_DATA, (uint8_t)(offset & 0xff));
+    cursor = offset;
+    if (batch_depth == 0) screen_flush();
 }
 
 void set_cursor(int col, int row) {
@@ -155,28 +410,66 @@ void kprint_at_color(char *message, int col, int row, char attr) {
         offset = get_cursor_offset();
         row = get_offset_row(offset);
         col = get_offset_col(offset);
+        if (redirect) {
+            redirect(message, strlen(message));
+            return;
+        }
+        serial_write(message, strlen(message));
     }
 
+    screen_begin();
     int i = 0;
     while (message[i] != 0) {
         offset = print_char(message[i++], col, row, attr);
         row = get_offset_row(offset);
         col = get_offset_col(offset);
     }
+    screen_end();
 }
 
+/* Blank the screen. The lines above it stay in the scrollback. */
 void clear_screen() {
-    int screen_size = MAX_COLS * MAX_ROWS;
-    uint8_t *screen = (uint8_t*) VIDEO_ADDRESS;
-
-    for (size_t i = 0; i < (size_t)screen_size; i++) {
-        screen[i*2] = ' ';
-        screen[i*2+1] = WHITE_ON_BLACK;
-    }
+    lines_init();
+    set_view(0);
+    for (int row = 0; row < rows; row++) blank_row(screen_row(row));
+    mark_all();
     set_cursor_offset(get_offset(0, 0));
 }
 
+/**
+ * Move the console to the framebuffer, if there is one. The text on
+ * the screen stays where it is, with lines from the scrollback filling
+ * the rows gained above it. Returns -1 if we stay in text mode.
+ */
+int screen_use_framebuffer() {
+    lines_init();
+    if (fb_active() || fb_init() != 0) return -1;
+
+    int old_cols = cols;
+    int old_rows = rows;
+    int back = FB_ROWS - old_rows;
+    if (back > (int)line_count - old_rows) back = line_count - old_rows;
+    screen_first = (screen_first + line_capacity - back) % line_capacity;
+    rows = FB_ROWS;
+    cols = FB_COLS;
+    for (int row = old_rows + back; row < rows; row++) blank_row(screen_row(row));
+    line_count += rows - old_rows - back;
+    if (line_count > line_capacity) line_count = line_capacity;
+
+    /* Offsets depend on the width */
+    cursor = get_offset(cursor / 2 % old_cols, cursor / 2 / old_cols + back);
+    backspace_limit = get_offset(backspace_limit / 2 % old_cols, backspace_limit / 2 / old_cols + back);
+
+    view_back = 0;
+    hw_cursor = -1;
+    mark_all();
+    if (batch_depth == 0) screen_flush();
+    return 0;
+}
+
+int screen_rows() { return rows; }
+int screen_cols() { return cols; }
 
-int get_offset(int col, int row) { return 2 * (row * MAX_COLS + col); }
-int get_offset_row(int offset) { return offset / (2 * MAX_COLS); }
-int get_offset_col(int offset) { return (offset - (get_offset_row(offset)*2*MAX_COLS))/2; }
+int get_offset(int col, int row) { return 2 * (row * cols + col); }
+int get_offset_row(int offset) { return offset / (2 * cols); }
+int get_offset_col(int offset) { return (offset - (get_offset_row(offset)*2*cols))/2; }
@@ -1,21 +1,43 @@
 #ifndef SCREEN_H
 #define SCREEN_H
 
+#include <stdint.h>
+
 #define VIDEO_ADDRESS 0xb8000
-#define MAX_ROWS 25
-#define MAX_COLS 80
+#define TEXT_ROWS 25
+#define TEXT_COLS 80
+#define MAX_ROWS 48  /* Largest console, on the framebuffer (see fb.h) */
+#define MAX_COLS 128
 #define WHITE_ON_BLACK 0x0f
 #define RED_ON_WHITE 0xf4
+#define ROW_BYTES (MAX_COLS * 2)  /* Line of the scrollback ring */
+#define VRAM_ROWS (0x8000 / (TEXT_COLS * 2)) /* Rows in the 32 KiB text window */
+#define SCROLLBACK_LINES 4096
+#define KPRINTF_BUFFER 256
 
 /* Screen i/o ports */
 #define REG_SCREEN_CTRL 0x3d4
 #define REG_SCREEN_DATA 0x3d5
+#define REG_START_ADDRESS 0x0c /* High byte, then low byte at 0x0d */
+#define REG_CURSOR 0x0e /* High byte, then low byte at 0x0f */
+
+/* Takes the output meant for the cursor while it is redirected */
+typedef void (*screen_output_t)(char *data, uint32_t len);
 
 /* Public kernel API */
 void clear_screen();
+int screen_use_framebuffer();
+int screen_rows();
+int screen_cols();
+void screen_begin();
+void screen_end();
+void screen_scroll_view(int lines);
+void screen_redirect(screen_output_t output);
 void kprint_at(char *message, int col, int row);
 void kprint_at_color(char *message, int col, int row, char attr);
 void kprint(char *message);
+void kprint_len(char *message, uint32_t len);
+int kprintf(const char *fmt, ...);
 void kprint_char_at(char c, int col, int row, char attr);
 void kprint_backspace();
 void set_backspace_limit(int limit);
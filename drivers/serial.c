@@ -0,0 +1,166 @@
+#include "serial.h"
+#include "../cpu/ports.h"
+#include "../cpu/isr.h"
+#include "../kernel/input.h"
+#include "../libc/function.h"
+#include "screen.h"
+#include <stdint.h>
+
+/* COM1 console. Output is queued in a ring and moved into the UART's
+ * FIFO a burst at a time, from the transmit interrupt or whenever more
+ * is queued, so printing only waits for the line once the ring is
+ * full. Shell commands run with interrupts off, so then nothing else
+ * would empty it: the writer polls the FIFO itself. Output is dropped
+ * only if the UART stops sending. Received bytes go to the same line
+ * discipline as the keyboard. */
+
+static uint8_t present = 0;
+static uint8_t fifo_size = 1;
+static uint8_t ier = 0;
+
+static char tx_ring[SERIAL_TX_RING];
+static uint32_t tx_head = 0; /* Next byte to queue, grows forever */
+static uint32_t tx_tail = 0; /* Next byte to send */
+static uint32_t dropped = 0;
+static uint8_t stalled = 0; /* The last wait for the FIFO timed out */
+
+static uint8_t rx_escape = 0; /* Bytes of an ESC [ sequence seen */
+static uint8_t rx_last = 0;
+
+static void set_ier(uint8_t value) {
+    ier = value;
+    port_byte_out(SERIAL_COM1 + SERIAL_IER, ier);
+}
+
+/* If the FIFO is empty, refill it from the ring. Interrupts must be off. */
+static void tx_fill() {
+    if (!(port_byte_in(SERIAL_COM1 + SERIAL_LSR) & SERIAL_LSR_THRE)) return;
+    stalled = 0;
+    for (uint8_t i = 0; i < fifo_size && tx_tail != tx_head; i++) {
+        port_byte_out(SERIAL_COM1 + SERIAL_DATA, tx_ring[tx_tail++ % SERIAL_TX_RING]);
+    }
+
+    /* The interrupt is only wanted while there is more to send */
+    uint8_t want = tx_tail != tx_head ? ier | SERIAL_IER_TX : ier & ~SERIAL_IER_TX;
+    if (want != ier) set_ier(want);
+}
+
+static void tx_put(char c) {
+    if (tx_head - tx_tail == SERIAL_TX_RING) {
+        /* Wait for the FIFO to empty, but only once for a dead line */
+        for (uint32_t i = 0; !stalled && i < SERIAL_TX_WAIT; i++) {
+            if (port_byte_in(SERIAL_COM1 + SERIAL_LSR) & SERIAL_LSR_THRE) break;
+        }
+        tx_fill();
+        if (tx_head - tx_tail == SERIAL_TX_RING) {
+            stalled = 1;
+            dropped++;
+            return;
+        }
+    }
+    tx_ring[tx_head++ % SERIAL_TX_RING] = c;
+}
+
+/* Queue 'len' bytes for the line, turning '\n' into "\r\n" */
+void serial_write(const char *data, uint32_t len) {
+    if (!present) return;
+    uint32_t flags = irq_save();
+    for (uint32_t i = 0; i < len; i++) {
+        if (data[i] == '\n') tx_put('\r');
+        tx_put(data[i]);
+    }
+    tx_fill();
+    irq_restore(flags);
+}
+
+/* Move queued output along, for callers waiting with interrupts off */
+void serial_poll() {
+    if (!present) return;
+    uint32_t flags = irq_save();
+    tx_fill();
+    irq_restore(flags);
+}
+
+/* Wait until everything queued has left the UART */
+void serial_drain() {
+    if (!present) return;
+    while (tx_tail != tx_head) serial_poll();
+    while (!(port_byte_in(SERIAL_COM1 + SERIAL_LSR) & SERIAL_LSR_TEMT));
+}
+
+uint32_t serial_tx_pending() {
+    return tx_head - tx_tail;
+}
+
+uint32_t serial_dropped() {
+    return dropped;
+}
+
+uint8_t serial_present() {
+    return present;
+}
+
+/* Terminals send Enter as '\r' (sometimes followed by '\n'), Backspace
+ * as DEL and the arrows as ESC [ A..D */
+static void rx_char(uint8_t c) {
+    uint8_t last = rx_last;
+    rx_last = c;
+
+    if (rx_escape == 1) {
+        rx_escape = c == '[' ? 2 : 0;
+        return;
+    }
+    if (rx_escape == 2) {
+        rx_escape = 0;
+        if (c == 'A') input_handle_scancode(SC_UP);
+        else if (c == 'B') input_handle_scancode(SC_DOWN);
+        else if (c == 'C') input_handle_scancode(SC_RIGHT);
+        else if (c == 'D') input_handle_scancode(SC_LEFT);
+        return;
+    }
+
+    if (c == 0x1b) rx_escape = 1;
+    else if (c == '\r') input_handle_char('\n');
+    else if (c == '\n') {
+        if (last != '\r') input_handle_char('\n');
+    } else if (c == 0x7f) input_handle_char(0x08);
+    else input_handle_char(c);
+}
+
+static void serial_callback(registers_t *regs) {
+    /* Reading IIR acknowledges a transmit interrupt, reading the data
+     * register a receive one */
+    port_byte_in(SERIAL_COM1 + SERIAL_IIR);
+
+    screen_begin();
+    while (port_byte_in(SERIAL_COM1 + SERIAL_LSR) & SERIAL_LSR_DR) {
+        rx_char(port_byte_in(SERIAL_COM1 + SERIAL_DATA));
+    }
+    tx_fill();
+    screen_end();
+    UNUSED(regs);
+}
+
+void init_serial() {
+    uint16_t base = SERIAL_COM1;
+    port_byte_out(base + SERIAL_IER, 0);
+    port_byte_out(base + SERIAL_LCR, 0x80); /* DLAB: the next two set the divisor */
+    port_byte_out(base + SERIAL_DATA, (115200 / SERIAL_BAUD) & 0xFF);
+    port_byte_out(base + SERIAL_IER, (115200 / SERIAL_BAUD) >> 8);
+    port_byte_out(base + SERIAL_LCR, 0x03); /* 8 bits, no parity, one stop bit */
+
+    /* A byte sent in loopback mode must come back, or there is no UART */
+    port_byte_out(base + SERIAL_MCR, 0x1E);
+    port_byte_out(base + SERIAL_DATA, 0xAE);
+    if (port_byte_in(base + SERIAL_DATA) != 0xAE) return;
+
+    /* Enable and clear the FIFOs, receive interrupt at 14 bytes (or
+     * after a short silence). IIR reads back 0xC0 if they work. */
+    port_byte_out(base + SERIAL_IIR, 0xC7);
+    fifo_size = (port_byte_in(base + SERIAL_IIR) & 0xC0) == 0xC0 ? SERIAL_FIFO : 1;
+
+    port_byte_out(base + SERIAL_MCR, 0x0B); /* DTR, RTS, and OUT2 to route the IRQ */
+    present = 1;
+    register_interrupt_handler(IRQ4, serial_callback);
+    set_ier(SERIAL_IER_RX);
+}
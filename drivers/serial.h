@@ -0,0 +1,35 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+
+#define SERIAL_COM1 0x3F8
+#define SERIAL_BAUD 115200
+#define SERIAL_FIFO 16     /* Bytes the 16550 transmit FIFO holds */
+#define SERIAL_TX_RING 8192
+#define SERIAL_TX_WAIT 100000 /* LSR reads (about 0.1 s) to wait for a full FIFO */
+
+/* Register offsets from the base port */
+#define SERIAL_DATA 0      /* THR/RBR, divisor low with DLAB */
+#define SERIAL_IER  1      /* Divisor high with DLAB */
+#define SERIAL_IIR  2      /* FCR when written */
+#define SERIAL_LCR  3
+#define SERIAL_MCR  4
+#define SERIAL_LSR  5
+
+#define SERIAL_IER_RX 0x01 /* Received data available */
+#define SERIAL_IER_TX 0x02 /* Transmit holding register empty */
+
+#define SERIAL_LSR_DR   0x01 /* A byte is waiting */
+#define SERIAL_LSR_THRE 0x20 /* The transmit FIFO is empty */
+#define SERIAL_LSR_TEMT 0x40 /* ...and so is the shift register */
+
+void init_serial();
+uint8_t serial_present();
+void serial_write(const char *data, uint32_t len);
+void serial_poll();
+void serial_drain();
+uint32_t serial_tx_pending();
+uint32_t serial_dropped();
+
+#endif
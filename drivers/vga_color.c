@@ -1,22 +1,35 @@
 #include "vga_color.h"
 #include "screen.h"
+#include "../kernel/klog.h"
 
 void kprint_color(char *message, enum vga_color fg, enum vga_color bg) {
     uint8_t color = vga_entry_color(fg, bg);
     kprint_at_color(message, -1, -1, color);
 }
 
+/* Messages go through the kernel log, which shows them on the screen
+ * through kprint_log() when it is drained */
 void kprint_info(char *message) {
-    kprint_color("[INFO] ", VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
-    kprint(message);
+    klog(KLOG_INFO, "%s", message);
 }
 
 void kprint_error(char *message) {
-    kprint_color("[ERROR] ", VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-    kprint(message);
+    klog(KLOG_ERROR, "%s", message);
 }
 
 void kprint_warning(char *message) {
-    kprint_color("[WARN] ", VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
-    kprint(message);
+    klog(KLOG_WARN, "%s", message);
+}
+
+/* Console sink for the kernel log */
+void kprint_log(klog_entry_t *entry) {
+    if (entry->level == KLOG_ERROR) {
+        kprint_color("[ERROR] ", VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+    } else if (entry->level == KLOG_WARN) {
+        kprint_color("[WARN] ", VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK);
+    } else {
+        kprint_color("[INFO] ", VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
+    }
+    kprint_len(entry->text, entry->len);
+    kprint("\n");
 }
@@ -2,6 +2,7 @@
 #define VGA_COLOR_H
 
 #include <stdint.h>
+#include "../kernel/klog.h"
 
 enum vga_color {
     VGA_COLOR_BLACK = 0,
@@ -30,5 +31,6 @@ void kprint_color(char *message, enum vga_color fg, enum vga_color bg);
 void kprint_info(char *message);
 void kprint_error(char *message);
 void kprint_warning(char *message);
+void kprint_log(klog_entry_t *entry);
 
 #endif
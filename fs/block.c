@@ -0,0 +1,317 @@
+#include "block.h"
+#include "../drivers/ata.h"
+#include "../libc/mem.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Buffer cache in front of the ATA disk.
+ * Buffers live on a hash table for lookup and on an LRU list for
+ * eviction (most recently used at the head). Reads can be followed by
+ * an asynchronous read-ahead, and dirty buffers are written back in
+ * runs of adjacent blocks, one ATA command per run. */
+
+static block_buf_t bufs[BLOCK_CACHE_SIZE];
+static block_buf_t *hash[BLOCK_HASH_SIZE];
+static block_buf_t *lru_head = NULL;
+static block_buf_t *lru_tail = NULL;
+static uint8_t ready = 0;
+static block_stats_t stats;
+
+/* One read-ahead can be in flight; it scatters into these buffers */
+static ata_request_t ra_req;
+static block_buf_t *ra_bufs[BLOCK_RA_MAX];
+
+static uint32_t block_hash(uint32_t blockno) {
+    return blockno % BLOCK_HASH_SIZE;
+}
+
+static void hash_insert(block_buf_t *b) {
+    uint32_t h = block_hash(b->blockno);
+    b->hash_next = hash[h];
+    hash[h] = b;
+}
+
+static void hash_remove(block_buf_t *b) {
+    block_buf_t **p = &hash[block_hash(b->blockno)];
+    while (*p) {
+        if (*p == b) {
+            *p = b->hash_next;
+            b->hash_next = NULL;
+            return;
+        }
+        p = &(*p)->hash_next;
+    }
+}
+
+static block_buf_t *hash_lookup(uint32_t blockno) {
+    block_buf_t *b = hash[block_hash(blockno)];
+    while (b && b->blockno != blockno) b = b->hash_next;
+    return b;
+}
+
+static void lru_unlink(block_buf_t *b) {
+    if (b->lru_prev) b->lru_prev->lru_next = b->lru_next;
+    else lru_head = b->lru_next;
+    if (b->lru_next) b->lru_next->lru_prev = b->lru_prev;
+    else lru_tail = b->lru_prev;
+    b->lru_prev = b->lru_next = NULL;
+}
+
+static void lru_push_front(block_buf_t *b) {
+    b->lru_prev = NULL;
+    b->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = b;
+    lru_head = b;
+    if (!lru_tail) lru_tail = b;
+}
+
+static void lru_touch(block_buf_t *b) {
+    lru_unlink(b);
+    lru_push_front(b);
+}
+
+/* Sector 'sector' of a request scattered over a run of buffers */
+static uint8_t *run_sector_buffer(ata_request_t *req, uint16_t sector) {
+    block_buf_t **run = (block_buf_t**)req->private;
+    return run[sector / BLOCK_SECTORS]->data + (sector % BLOCK_SECTORS) * ATA_SECTOR_SIZE;
+}
+
+/**
+ * Write every dirty buffer back, except those the journal has pinned
+ * until their transaction commits. Dirty buffers are sorted by block
+ * number and adjacent ones are merged, so a burst of small writes to
+ * neighbouring blocks costs one ATA command instead of one per block.
+ */
+int block_flush() {
+    if (!ready) return -1;
+
+    block_buf_t *dirty[BLOCK_CACHE_SIZE];
+    int count = 0;
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        if ((bufs[i].flags & (B_DIRTY | B_PINNED)) == B_DIRTY) dirty[count++] = &bufs[i];
+    }
+
+    /* Insertion sort: the cache is small */
+    for (int i = 1; i < count; i++) {
+        block_buf_t *b = dirty[i];
+        int j = i - 1;
+        while (j >= 0 && dirty[j]->blockno > b->blockno) {
+            dirty[j + 1] = dirty[j];
+            j--;
+        }
+        dirty[j + 1] = b;
+    }
+
+    int result = 0;
+    int start = 0;
+    while (start < count) {
+        int len = 1;
+        while (start + len < count && len < BLOCK_RUN_MAX &&
+               dirty[start + len]->blockno == dirty[start]->blockno + len) {
+            len++;
+        }
+
+        ata_request_t req;
+        req.lba = dirty[start]->blockno * BLOCK_SECTORS;
+        req.count = len * BLOCK_SECTORS;
+        req.write = 1;
+        req.sector_buffer = run_sector_buffer;
+        req.complete = NULL;
+        req.private = &dirty[start];
+        if (ata_submit(&req) != 0 || ata_wait(&req) != 0) {
+            result = -1;
+        } else {
+            for (int i = start; i < start + len; i++) dirty[i]->flags &= ~B_DIRTY;
+            stats.writes++;
+            stats.written += len;
+        }
+        start += len;
+    }
+    return result;
+}
+
+/* Find a buffer we can reuse, writing dirty ones back if we must */
+static block_buf_t *block_alloc(uint32_t blockno) {
+    block_buf_t *b;
+    for (int pass = 0; pass < 2; pass++) {
+        for (b = lru_tail; b; b = b->lru_prev) {
+            if (b->refcnt == 0 && !(b->flags & (B_BUSY | B_DIRTY))) break;
+        }
+        if (b) break;
+        /* Everything idle is dirty: write all of it back in one go */
+        if (block_flush() != 0) return NULL;
+    }
+    if (!b) return NULL;
+
+    if (b->blockno != BLOCK_NONE) hash_remove(b);
+    b->blockno = blockno;
+    b->flags = 0;
+    hash_insert(b);
+    lru_touch(b);
+    return b;
+}
+
+static void readahead_complete(ata_request_t *req) {
+    uint32_t n = req->count / BLOCK_SECTORS;
+    for (uint32_t i = 0; i < n; i++) {
+        block_buf_t *b = ra_bufs[i];
+        b->flags &= ~B_BUSY;
+        if (req->state == ATA_REQ_DONE) {
+            b->flags |= B_VALID;
+        } else {
+            hash_remove(b);
+            b->blockno = BLOCK_NONE;
+        }
+    }
+}
+
+/**
+ * Start fetching 'ra' ahead of 'blockno' without waiting for it.
+ * Only the uncached blocks directly following the reader are fetched,
+ * as one contiguous command, and never past block 'limit'.
+ */
+static void readahead_submit(readahead_t *ra, uint32_t blockno, uint32_t limit) {
+    uint32_t end = blockno + 1 + ra->window;
+    if (end > limit) end = limit;
+    if (ra->ahead < blockno + 1) ra->ahead = blockno + 1;
+
+    /* Refill once the reader has consumed half of the window */
+    if (ra->ahead >= end || ra->ahead - blockno > ra->window / 2) return;
+    if (ra_req.state == ATA_REQ_PENDING) return;
+
+    uint32_t n = 0;
+    while (ra->ahead + n < end && n < BLOCK_RA_MAX) {
+        if (hash_lookup(ra->ahead + n)) break;
+        block_buf_t *b = block_alloc(ra->ahead + n);
+        if (!b) break;
+        b->flags = B_BUSY;
+        ra_bufs[n++] = b;
+    }
+    if (n == 0) {
+        ra->ahead++;
+        return;
+    }
+
+    ra_req.lba = ra->ahead * BLOCK_SECTORS;
+    ra_req.count = n * BLOCK_SECTORS;
+    ra_req.write = 0;
+    ra_req.sector_buffer = run_sector_buffer;
+    ra_req.complete = readahead_complete;
+    ra_req.private = ra_bufs;
+    if (ata_submit(&ra_req) != 0) {
+        ra_req.state = ATA_REQ_ERROR;
+        readahead_complete(&ra_req);
+        return;
+    }
+    stats.ra_blocks += n;
+    ra->ahead += n;
+}
+
+/* Adapt the read-ahead window to the access pattern */
+static void readahead_update(readahead_t *ra, uint32_t blockno) {
+    if (blockno == ra->next) {
+        if (ra->window == 0) ra->window = BLOCK_RA_INIT;
+        else if (ra->window < BLOCK_RA_MAX) ra->window *= 2;
+        if (ra->window > BLOCK_RA_MAX) ra->window = BLOCK_RA_MAX;
+    } else {
+        ra->window = 0;
+        ra->ahead = blockno + 1;
+    }
+    ra->next = blockno + 1;
+}
+
+void readahead_init(readahead_t *ra) {
+    ra->next = 0;
+    ra->window = 0;
+    ra->ahead = 0;
+}
+
+/* Get a buffer for 'blockno' without reading it: for blocks that are
+ * about to be overwritten entirely */
+block_buf_t *block_get(uint32_t blockno) {
+    if (!ready) return NULL;
+    block_buf_t *b = hash_lookup(blockno);
+    if (b) {
+        while (b->flags & B_BUSY) ata_poll();
+        if (b->blockno != blockno) return block_get(blockno);
+    } else {
+        b = block_alloc(blockno);
+        if (!b) return NULL;
+    }
+    b->flags |= B_VALID;
+    b->refcnt++;
+    lru_touch(b);
+    return b;
+}
+
+/**
+ * Return the buffer holding 'blockno', reading it if needed.
+ * If 'ra' is given, sequential access is detected and the next
+ * blocks (up to 'limit', exclusive) are requested in the background.
+ * The buffer must be handed back with block_release.
+ */
+block_buf_t *block_read(uint32_t blockno, readahead_t *ra, uint32_t limit) {
+    if (!ready) return NULL;
+
+    block_buf_t *b = hash_lookup(blockno);
+    if (b && (b->flags & B_BUSY)) {
+        while (b->flags & B_BUSY) ata_poll();
+        stats.ra_hits++;
+        /* A failed read-ahead drops its buffers: retry below */
+        if (b->blockno != blockno) b = NULL;
+    } else if (b) {
+        stats.hits++;
+    }
+
+    if (!b) {
+        b = block_alloc(blockno);
+        if (!b) return NULL;
+        if (ata_read(blockno * BLOCK_SECTORS, BLOCK_SECTORS, b->data) != 0) {
+            hash_remove(b);
+            b->blockno = BLOCK_NONE;
+            return NULL;
+        }
+        b->flags |= B_VALID;
+        stats.misses++;
+    }
+
+    b->refcnt++;
+    lru_touch(b);
+
+    if (ra) {
+        readahead_update(ra, blockno);
+        if (ra->window) readahead_submit(ra, blockno, limit);
+    }
+    return b;
+}
+
+void block_mark_dirty(block_buf_t *b) {
+    b->flags |= B_DIRTY | B_VALID;
+}
+
+void block_release(block_buf_t *b) {
+    if (b && b->refcnt > 0) b->refcnt--;
+}
+
+block_stats_t *block_get_stats() {
+    return &stats;
+}
+
+int block_init() {
+    if (!ata_present()) return -1;
+    if (ready) return 0;
+
+    for (int i = 0; i < BLOCK_HASH_SIZE; i++) hash[i] = NULL;
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        bufs[i].blockno = BLOCK_NONE;
+        bufs[i].flags = 0;
+        bufs[i].refcnt = 0;
+        bufs[i].data = (uint8_t*)kmalloc(BLOCK_SIZE, 1, NULL);
+        bufs[i].hash_next = NULL;
+        bufs[i].lru_prev = bufs[i].lru_next = NULL;
+        lru_push_front(&bufs[i]);
+    }
+    ra_req.state = ATA_REQ_IDLE;
+    ready = 1;
+    return 0;
+}
@@ -0,0 +1,62 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+#include "../drivers/ata.h"
+
+#define BLOCK_SIZE 4096
+#define BLOCK_SECTORS (BLOCK_SIZE / ATA_SECTOR_SIZE)
+#define BLOCK_CACHE_SIZE 64
+#define BLOCK_HASH_SIZE 64
+#define BLOCK_NONE 0xFFFFFFFF
+
+/* Most blocks a single ATA command can move (256 sectors) */
+#define BLOCK_RUN_MAX (ATA_MAX_SECTORS / BLOCK_SECTORS)
+
+/* Read-ahead window, in blocks. It starts at RA_INIT on the first
+ * sequential hit and doubles up to RA_MAX. */
+#define BLOCK_RA_INIT 4
+#define BLOCK_RA_MAX BLOCK_RUN_MAX
+
+/* Flags */
+#define B_VALID 0x01 /* Data matches the disk (or is newer, see B_DIRTY) */
+#define B_DIRTY 0x02 /* Must be written back */
+#define B_BUSY  0x04 /* An asynchronous read is filling it */
+#define B_PINNED 0x08 /* Journaled: not written home before it commits */
+
+typedef struct block_buf {
+    uint32_t blockno;
+    uint8_t flags;
+    uint16_t refcnt;
+    uint8_t *data;
+    struct block_buf *hash_next;
+    struct block_buf *lru_prev;
+    struct block_buf *lru_next;
+} block_buf_t;
+
+/* Per open file read-ahead state */
+typedef struct {
+    uint32_t next;   /* Block a sequential reader asks for next */
+    uint32_t window; /* Current window size, 0 after random access */
+    uint32_t ahead;  /* First block not yet requested */
+} readahead_t;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t ra_blocks;   /* Blocks fetched by read-ahead */
+    uint32_t ra_hits;     /* Reads served by a read-ahead block */
+    uint32_t writes;      /* ATA write commands issued */
+    uint32_t written;     /* Blocks written back */
+} block_stats_t;
+
+int block_init();
+block_buf_t *block_read(uint32_t blockno, readahead_t *ra, uint32_t limit);
+block_buf_t *block_get(uint32_t blockno);
+void block_mark_dirty(block_buf_t *b);
+void block_release(block_buf_t *b);
+int block_flush();
+void readahead_init(readahead_t *ra);
+block_stats_t *block_get_stats();
+
+#endif
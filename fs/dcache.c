@@ -0,0 +1,121 @@
+#include "dcache.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Directory entry cache: a hash of every file in the table, keyed by
+ * (parent, case-folded name). Files are chained through their 'next'
+ * field, so the cache needs no memory of its own besides the buckets.
+ *
+ * The whole tree lives in the file table, so every file is indexed and
+ * a miss is authoritative: a name that is not in its bucket does not
+ * exist. That is what a negative entry would remember, without having
+ * to invalidate anything when the name is created later. */
+
+static int32_t *buckets = NULL;
+static uint32_t bucket_count = 0; /* Always a power of two */
+static uint32_t entries = 0;
+
+/* FNV-1a over the lower-cased name, so lookups ignore case like strcmpi */
+uint32_t dcache_hash(char *name) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; name[i]; i++) {
+        h ^= (uint8_t)tolower(name[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t bucket_of(uint32_t hash, int32_t parent) {
+    uint32_t h = hash ^ ((uint32_t)parent * 2654435761u);
+    return (h ^ (h >> 16)) & (bucket_count - 1);
+}
+
+static void link(file_t *files, int32_t fd) {
+    uint32_t b = bucket_of(files[fd].name_hash, files[fd].parent_index);
+    files[fd].next = buckets[b];
+    buckets[b] = fd;
+}
+
+static int32_t *alloc_buckets(uint32_t n) {
+    int32_t *table = (int32_t*)kmalloc(n * sizeof(int32_t), 0, NULL);
+    if (table) memory_set((uint8_t*)table, 0xFF, n * sizeof(int32_t));
+    return table;
+}
+
+/* Move every chained file into a table twice as big */
+static void grow(file_t *files) {
+    int32_t *old = buckets;
+    uint32_t old_count = bucket_count;
+
+    int32_t *table = alloc_buckets(old_count * 2);
+    if (!table) return; /* Keep the longer chains */
+    buckets = table;
+    bucket_count = old_count * 2;
+
+    for (uint32_t b = 0; b < old_count; b++) {
+        int32_t fd = old[b];
+        while (fd != -1) {
+            int32_t next = files[fd].next;
+            link(files, fd);
+            fd = next;
+        }
+    }
+    kfree((uint32_t)old);
+}
+
+/* Index every used file among the first 'count' slots */
+int dcache_rebuild(file_t *files, int32_t count) {
+    uint32_t n = DCACHE_MIN_BUCKETS;
+    while (n < (uint32_t)count) n *= 2;
+
+    int32_t *table = alloc_buckets(n);
+    if (!table) return -1;
+    kfree((uint32_t)buckets);
+    buckets = table;
+    bucket_count = n;
+
+    entries = 0;
+    for (int32_t i = 0; i < count; i++) {
+        if (!files[i].used) continue;
+        files[i].name_hash = dcache_hash(files[i].name);
+        link(files, i);
+        entries++;
+    }
+    return 0;
+}
+
+/* Add a file whose name and parent are set. The table keeps about one
+ * file per bucket, doubling when it gets fuller than that. */
+void dcache_insert(file_t *files, int32_t fd) {
+    if (!buckets && dcache_rebuild(files, 0) != 0) return;
+    if (entries >= bucket_count) grow(files);
+
+    files[fd].name_hash = dcache_hash(files[fd].name);
+    link(files, fd);
+    entries++;
+}
+
+void dcache_remove(file_t *files, int32_t fd) {
+    if (!buckets) return;
+    int32_t *p = &buckets[bucket_of(files[fd].name_hash, files[fd].parent_index)];
+    while (*p != -1 && *p != fd) p = &files[*p].next;
+    if (*p == -1) return;
+    *p = files[fd].next;
+    entries--;
+}
+
+int32_t dcache_lookup(file_t *files, char *name, int32_t parent) {
+    if (!buckets) return -1;
+    uint32_t hash = dcache_hash(name);
+    int32_t fd = buckets[bucket_of(hash, parent)];
+    while (fd != -1) {
+        file_t *f = &files[fd];
+        if (f->name_hash == hash && f->parent_index == parent && strcmpi(f->name, name) == 0) {
+            return fd;
+        }
+        fd = f->next;
+    }
+    return -1;
+}
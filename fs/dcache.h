@@ -0,0 +1,15 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stdint.h>
+#include "fs.h"
+
+#define DCACHE_MIN_BUCKETS 64
+
+uint32_t dcache_hash(char *name);
+int dcache_rebuild(file_t *files, int32_t count);
+void dcache_insert(file_t *files, int32_t fd);
+void dcache_remove(file_t *files, int32_t fd);
+int32_t dcache_lookup(file_t *files, char *name, int32_t parent);
+
+#endif
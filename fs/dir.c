@@ -0,0 +1,126 @@
+#include "dir.h"
+#include "../libc/mem.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* A directory's children live in a sorted array cut into fixed-size
+ * chunks: a two-level B-tree. Finding a position is a binary search over
+ * the chunks and then inside one, and inserting only shifts the entries
+ * of that chunk, so even a directory with tens of thousands of files
+ * stays cheap to update. A full chunk is split in half, and an empty
+ * one is freed. */
+
+static int entry_less(dir_entry_t a, dir_entry_t b) {
+    return a.hash < b.hash || (a.hash == b.hash && a.fd < b.fd);
+}
+
+/* First chunk whose last entry is not below 'e', or the last chunk */
+static uint32_t find_chunk(dir_index_t *d, dir_entry_t e) {
+    uint32_t lo = 0, hi = d->chunk_count - 1;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        dir_chunk_t *c = d->chunks[mid];
+        if (entry_less(c->entries[c->count - 1], e)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* First position in the chunk whose entry is not below 'e' */
+static uint32_t lower_bound(dir_chunk_t *c, dir_entry_t e) {
+    uint32_t lo = 0, hi = c->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (entry_less(c->entries[mid], e)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Insert an empty chunk at position 'at' */
+static dir_chunk_t *insert_chunk(dir_index_t *d, uint32_t at) {
+    if (d->chunk_count == d->chunk_capacity) {
+        uint32_t capacity = d->chunk_capacity ? d->chunk_capacity * 2 : 4;
+        dir_chunk_t **grown = (dir_chunk_t**)krealloc((uint32_t)d->chunks, capacity * sizeof(dir_chunk_t*));
+        if (!grown) return NULL;
+        d->chunks = grown;
+        d->chunk_capacity = capacity;
+    }
+
+    dir_chunk_t *c = (dir_chunk_t*)kmalloc(sizeof(dir_chunk_t), 0, NULL);
+    if (!c) return NULL;
+    c->count = 0;
+
+    for (uint32_t i = d->chunk_count; i > at; i--) d->chunks[i] = d->chunks[i - 1];
+    d->chunks[at] = c;
+    d->chunk_count++;
+    return c;
+}
+
+static void remove_chunk(dir_index_t *d, uint32_t at) {
+    kfree((uint32_t)d->chunks[at]);
+    for (uint32_t i = at; i + 1 < d->chunk_count; i++) d->chunks[i] = d->chunks[i + 1];
+    d->chunk_count--;
+}
+
+int dir_add(dir_index_t *d, uint32_t hash, int32_t fd) {
+    dir_entry_t e = { hash, fd };
+    if (d->chunk_count == 0 && !insert_chunk(d, 0)) return -1;
+
+    uint32_t at = find_chunk(d, e);
+    dir_chunk_t *c = d->chunks[at];
+
+    if (c->count == DIR_CHUNK_SIZE) {
+        dir_chunk_t *right = insert_chunk(d, at + 1);
+        if (!right) return -1;
+        uint32_t half = DIR_CHUNK_SIZE / 2;
+        memory_copy((uint8_t*)&c->entries[half], (uint8_t*)right->entries, half * sizeof(dir_entry_t));
+        c->count = half;
+        right->count = half;
+        if (entry_less(c->entries[half - 1], e)) c = right;
+    }
+
+    uint32_t pos = lower_bound(c, e);
+    for (uint32_t i = c->count; i > pos; i--) c->entries[i] = c->entries[i - 1];
+    c->entries[pos] = e;
+    c->count++;
+    d->count++;
+    return 0;
+}
+
+void dir_remove(dir_index_t *d, uint32_t hash, int32_t fd) {
+    if (d->chunk_count == 0) return;
+    dir_entry_t e = { hash, fd };
+
+    uint32_t at = find_chunk(d, e);
+    dir_chunk_t *c = d->chunks[at];
+    uint32_t pos = lower_bound(c, e);
+    if (pos == c->count || c->entries[pos].fd != fd) return;
+
+    for (uint32_t i = pos; i + 1 < c->count; i++) c->entries[i] = c->entries[i + 1];
+    c->count--;
+    d->count--;
+    if (c->count == 0) remove_chunk(d, at);
+}
+
+void dir_free(dir_index_t *d) {
+    for (uint32_t i = 0; i < d->chunk_count; i++) kfree((uint32_t)d->chunks[i]);
+    kfree((uint32_t)d->chunks);
+    memory_set((uint8_t*)d, 0, sizeof(dir_index_t));
+}
+
+void dir_cursor_init(dir_cursor_t *c) {
+    c->chunk = 0;
+    c->pos = 0;
+}
+
+/* Next child in index order, or -1 at the end */
+int32_t dir_next(dir_index_t *d, dir_cursor_t *c) {
+    while (c->chunk < d->chunk_count) {
+        dir_chunk_t *chunk = d->chunks[c->chunk];
+        if (c->pos < chunk->count) return chunk->entries[c->pos++].fd;
+        c->chunk++;
+        c->pos = 0;
+    }
+    return -1;
+}
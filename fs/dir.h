@@ -0,0 +1,38 @@
+#ifndef DIR_H
+#define DIR_H
+
+#include <stdint.h>
+
+/* Entries per chunk of a directory index; must be even */
+#define DIR_CHUNK_SIZE 128
+
+typedef struct {
+    uint32_t hash; // Name hash of the child (see dcache_hash)
+    int32_t fd;
+} dir_entry_t;
+
+typedef struct {
+    uint32_t count;
+    dir_entry_t entries[DIR_CHUNK_SIZE];
+} dir_chunk_t;
+
+/* Children of one directory, sorted by (hash, fd) */
+typedef struct {
+    dir_chunk_t **chunks;
+    uint32_t chunk_count;
+    uint32_t chunk_capacity;
+    uint32_t count;
+} dir_index_t;
+
+typedef struct {
+    uint32_t chunk;
+    uint32_t pos;
+} dir_cursor_t;
+
+int dir_add(dir_index_t *d, uint32_t hash, int32_t fd);
+void dir_remove(dir_index_t *d, uint32_t hash, int32_t fd);
+void dir_free(dir_index_t *d);
+void dir_cursor_init(dir_cursor_t *c);
+int32_t dir_next(dir_index_t *d, dir_cursor_t *c);
+
+#endif
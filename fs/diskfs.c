@@ -0,0 +1,471 @@
+#include "diskfs.h"
+#include "ondisk.h"
+#include "block.h"
+#include "journal.h"
+#include "../drivers/ata.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Backing store for the filesystem when a formatted disk is attached.
+ * The in-memory file table doubles as the inode cache (slot i is inode
+ * i); this file keeps the on-disk inodes, bitmaps and file extents in
+ * step with it, going through the block cache. Metadata changes go
+ * through the journal, file data is written directly. */
+
+static fs_superblock_t sb;
+
+/* Runs freed by the running transaction. Until it commits, a crash
+ * gives them back to the file they came from, so they must not be
+ * handed to another one whose data is written home straight away. */
+static fs_extent_t freed[DISKFS_FREED_RUNS];
+static uint32_t freed_count = 0;
+static uint32_t freed_sequence = 0; /* Transaction they were freed in */
+
+static uint32_t min(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+/**********************************************************
+ * Bitmaps                                                *
+ **********************************************************/
+
+static int bitmap_get(uint32_t first, uint32_t bit) {
+    block_buf_t *b = block_read(first + bit / FS_BITS_PER_BLOCK, NULL, 0);
+    if (!b) return 1; /* Treat unreadable as used */
+    uint32_t i = bit % FS_BITS_PER_BLOCK;
+    int used = (b->data[i / 8] >> (i % 8)) & 1;
+    block_release(b);
+    return used;
+}
+
+static int bitmap_set(uint32_t first, uint32_t bit, uint8_t value) {
+    block_buf_t *b = block_read(first + bit / FS_BITS_PER_BLOCK, NULL, 0);
+    if (!b) return -1;
+    uint32_t i = bit % FS_BITS_PER_BLOCK;
+    if (value) b->data[i / 8] |= (1 << (i % 8));
+    else b->data[i / 8] &= ~(1 << (i % 8));
+    int result = journal_dirty(b);
+    block_release(b);
+    return result;
+}
+
+/* First clear bit of the block bitmap in [from, to), or BLOCK_NONE.
+ * Fully used words are skipped 32 blocks at a time. */
+static uint32_t find_free(uint32_t from, uint32_t to) {
+    uint32_t bit = from;
+    while (bit < to) {
+        block_buf_t *b = block_read(sb.block_bitmap + bit / FS_BITS_PER_BLOCK, NULL, 0);
+        if (!b) return BLOCK_NONE;
+        uint32_t *words = (uint32_t*)b->data;
+        uint32_t end = min((bit / FS_BITS_PER_BLOCK + 1) * FS_BITS_PER_BLOCK, to);
+
+        while (bit < end) {
+            uint32_t i = bit % FS_BITS_PER_BLOCK;
+            uint32_t w = words[i / 32];
+            if (w == 0xFFFFFFFF && i % 32 == 0) {
+                bit += 32;
+            } else if (!(w & (1u << (i % 32)))) {
+                block_release(b);
+                return bit;
+            } else {
+                bit++;
+            }
+        }
+        block_release(b);
+    }
+    return BLOCK_NONE;
+}
+
+/* Forget the freed runs once their transaction has committed */
+static void freed_expire() {
+    if (freed_count && freed_sequence != journal_sequence()) freed_count = 0;
+}
+
+/* End of the not yet committed freed run holding 'bit', or 0 */
+static uint32_t freed_end(uint32_t bit) {
+    freed_expire();
+    for (uint32_t i = 0; i < freed_count; i++) {
+        if (bit >= freed[i].start && bit < freed[i].start + freed[i].length)
+            return freed[i].start + freed[i].length;
+    }
+    return 0;
+}
+
+/* Returns -1 if there is no room to remember another run */
+static int freed_add(uint32_t start, uint32_t length) {
+    freed_expire();
+    freed_sequence = journal_sequence();
+
+    /* Shrinking frees from the end back, growing undoes forwards */
+    if (freed_count) {
+        fs_extent_t *last = &freed[freed_count - 1];
+        if (start + length == last->start) {
+            last->start = start;
+            last->length += length;
+            return 0;
+        }
+        if (last->start + last->length == start) {
+            last->length += length;
+            return 0;
+        }
+    }
+    if (freed_count == DISKFS_FREED_RUNS) return -1;
+    freed[freed_count].start = start;
+    freed[freed_count].length = length;
+    freed_count++;
+    return 0;
+}
+
+/* First block in [from, to) that is free and was not freed by the
+ * running transaction, or BLOCK_NONE */
+static uint32_t find_reusable(uint32_t from, uint32_t to) {
+    uint32_t bit;
+    while ((bit = find_free(from, to)) != BLOCK_NONE) {
+        uint32_t end = freed_end(bit);
+        if (!end) return bit;
+        from = end;
+    }
+    return BLOCK_NONE;
+}
+
+/**
+ * Allocate up to 'want' contiguous blocks, preferably at 'goal'.
+ * Stores how many were allocated (0 when the disk is full) in 'got'
+ * and the first one in 'start'. Returns -1 if the bitmap could not be
+ * changed; the blocks counted in 'got' are still allocated.
+ */
+static int alloc_run(uint32_t goal, uint32_t want, uint32_t *start, uint32_t *got) {
+    if (goal < sb.data_start || goal >= sb.block_count) goal = sb.data_start;
+    *got = 0;
+
+    uint32_t first = find_reusable(goal, sb.block_count);
+    if (first == BLOCK_NONE) first = find_reusable(sb.data_start, goal);
+    if (first == BLOCK_NONE) return 0;
+
+    int result = 0;
+    uint32_t n = 0;
+    while (n < want && first + n < sb.block_count &&
+           !bitmap_get(sb.block_bitmap, first + n) && !freed_end(first + n)) {
+        /* A bit that failed to log may still be set: it is left out,
+         * lost until the next mount rather than handed out twice */
+        if (bitmap_set(sb.block_bitmap, first + n, 1) != 0) {
+            result = -1;
+            break;
+        }
+        n++;
+    }
+    sb.free_blocks -= n;
+    *start = first;
+    *got = n;
+    return result;
+}
+
+/* Returns -1 if the bitmap could not be changed */
+static int free_run(uint32_t start, uint32_t length) {
+    /* Left allocated if it cannot be tracked: lost, but never shared.
+     * diskfs_begin() commits before this can happen. */
+    if (freed_add(start, length) != 0) return 0;
+    int result = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        if (bitmap_set(sb.block_bitmap, start + i, 0) != 0) result = -1;
+    }
+    sb.free_blocks += length;
+    return result;
+}
+
+/**********************************************************
+ * Extents                                                *
+ **********************************************************/
+
+static uint32_t file_blocks(file_t *f) {
+    uint32_t n = 0;
+    for (int i = 0; i < f->extent_count; i++) n += f->extents[i].length;
+    return n;
+}
+
+/* Disk block holding block 'index' of the file, and the end of its
+ * extent (read-ahead never crosses it) */
+static uint32_t file_block(file_t *f, uint32_t index, uint32_t *extent_end) {
+    for (int i = 0; i < f->extent_count; i++) {
+        fs_extent_t *e = &f->extents[i];
+        if (index < e->length) {
+            if (extent_end) *extent_end = e->start + e->length;
+            return e->start + index;
+        }
+        index -= e->length;
+    }
+    return BLOCK_NONE;
+}
+
+/**
+ * Grow or shrink the file to exactly 'nblocks' blocks. New blocks
+ * extend the last extent in place when possible, so a file written in
+ * one go usually ends up as a single extent. Returns -1 if the file
+ * could not grow or the bitmap could not be changed.
+ */
+int32_t diskfs_resize(file_t *f, uint32_t nblocks) {
+    uint32_t have = file_blocks(f);
+    int result = 0;
+
+    while (have > nblocks) {
+        fs_extent_t *e = &f->extents[f->extent_count - 1];
+        uint32_t drop = min(e->length, have - nblocks);
+        if (free_run(e->start + e->length - drop, drop) != 0) result = -1;
+        e->length -= drop;
+        have -= drop;
+        if (e->length == 0) f->extent_count--;
+    }
+
+    uint32_t original = have;
+    while (have < nblocks) {
+        fs_extent_t *last = f->extent_count ? &f->extents[f->extent_count - 1] : NULL;
+        uint32_t goal = last ? last->start + last->length : sb.data_start;
+        uint32_t start, got;
+        int failed = alloc_run(goal, nblocks - have, &start, &got);
+
+        if (!failed && got && last && start == goal) {
+            last->length += got;
+        } else if (!failed && got && f->extent_count < FS_EXTENTS) {
+            f->extents[f->extent_count].start = start;
+            f->extents[f->extent_count].length = got;
+            f->extent_count++;
+        } else {
+            /* Disk full, too fragmented or the bitmap failed: undo
+             * what we took */
+            if (got) free_run(start, got);
+            diskfs_resize(f, original);
+            return -1;
+        }
+        have += got;
+    }
+    return result;
+}
+
+/**********************************************************
+ * Inodes                                                 *
+ **********************************************************/
+
+/* Returns -1 if the change could not be logged */
+int diskfs_write_inode(int32_t ino, file_t *f) {
+    block_buf_t *b = block_read(sb.inode_table + ino / FS_INODES_PER_BLOCK, NULL, 0);
+    if (!b) return -1;
+    fs_inode_t *inode = (fs_inode_t*)b->data + ino % FS_INODES_PER_BLOCK;
+
+    memory_set((uint8_t*)inode, 0, sizeof(fs_inode_t));
+    if (f->used) {
+        strcpy(inode->name, f->name);
+        inode->size = f->size;
+        inode->parent = f->parent_index;
+        inode->flags = FS_INODE_USED | (f->is_dir ? FS_INODE_DIR : 0);
+        inode->extent_count = f->extent_count;
+        memory_copy((uint8_t*)f->extents, (uint8_t*)inode->extents, sizeof(f->extents));
+    }
+    int result = journal_dirty(b);
+    block_release(b);
+
+    if (bitmap_set(sb.inode_bitmap, ino, f->used) != 0) result = -1;
+    return result;
+}
+
+static void read_inode(fs_inode_t *inode, file_t *f) {
+    memory_set((uint8_t*)f, 0, sizeof(file_t));
+    if (!(inode->flags & FS_INODE_USED)) return;
+
+    memory_copy((uint8_t*)inode->name, (uint8_t*)f->name, FS_NAME_LEN);
+    f->name[FS_NAME_LEN - 1] = '\0';
+    f->size = inode->size;
+    f->parent_index = inode->parent;
+    f->is_dir = (inode->flags & FS_INODE_DIR) ? 1 : 0;
+    f->extent_count = min(inode->extent_count, FS_EXTENTS);
+    memory_copy((uint8_t*)inode->extents, (uint8_t*)f->extents, sizeof(f->extents));
+    f->used = 1;
+}
+
+/**********************************************************
+ * File data                                              *
+ **********************************************************/
+
+/**
+ * Copy up to 'size' bytes starting at 'offset' into 'buffer'.
+ * Each extent is read through the block cache with the reader's
+ * read-ahead state 'ra' (if any), so a sequential reader keeps the
+ * disk busy ahead of it instead of waiting for every block.
+ */
+int32_t diskfs_read(file_t *f, readahead_t *ra, uint32_t offset, uint8_t *buffer, uint32_t size) {
+    if (offset >= f->size) return 0;
+    size = min(size, f->size - offset);
+
+    /* Reading from the start opens a new sequential stream */
+    if (ra && offset == 0) {
+        readahead_init(ra);
+        ra->next = file_block(f, 0, NULL);
+    }
+
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t pos = offset + done;
+        uint32_t extent_end;
+        uint32_t blockno = file_block(f, pos / FS_BLOCK_SIZE, &extent_end);
+        if (blockno == BLOCK_NONE) break;
+
+        block_buf_t *b = block_read(blockno, ra, extent_end);
+        if (!b) return done ? (int32_t)done : -1;
+        uint32_t in_block = pos % FS_BLOCK_SIZE;
+        uint32_t n = min(FS_BLOCK_SIZE - in_block, size - done);
+        memory_copy(b->data + in_block, buffer + done, n);
+        block_release(b);
+        done += n;
+    }
+    return done;
+}
+
+static uint32_t blocks_for(uint32_t size) {
+    return (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+}
+
+/* Zero block 'index' of the file without reading it first */
+static int zero_block(file_t *f, uint32_t index) {
+    block_buf_t *b = block_get(file_block(f, index, NULL));
+    if (!b) return -1;
+    memory_set(b->data, 0, FS_BLOCK_SIZE);
+    block_mark_dirty(b);
+    block_release(b);
+    return 0;
+}
+
+/**
+ * Write 'size' bytes at 'offset', growing the file if needed. Blocks
+ * that are overwritten whole are never read; new blocks that are only
+ * partly written are zeroed, so a gap past the old end reads as zeros.
+ */
+int32_t diskfs_write(int32_t ino, file_t *f, uint32_t offset, uint8_t *buffer, uint32_t size) {
+    uint32_t end = offset + size;
+    if (end < offset) return -1;
+
+    uint32_t have = file_blocks(f);
+    uint32_t nblocks = blocks_for(end);
+    if (nblocks > have) {
+        if (diskfs_resize(f, nblocks) != 0) return -1;
+        for (uint32_t i = have; i < nblocks; i++) {
+            if (i * FS_BLOCK_SIZE >= offset && (i + 1) * FS_BLOCK_SIZE <= end) continue;
+            if (zero_block(f, i) != 0) return -1;
+        }
+    }
+
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t pos = offset + done;
+        uint32_t in_block = pos % FS_BLOCK_SIZE;
+        uint32_t n = min(FS_BLOCK_SIZE - in_block, size - done);
+        uint32_t blockno = file_block(f, pos / FS_BLOCK_SIZE, NULL);
+
+        block_buf_t *b = n == FS_BLOCK_SIZE ? block_get(blockno) : block_read(blockno, NULL, 0);
+        if (!b) break;
+        memory_copy(buffer + done, b->data + in_block, n);
+        block_mark_dirty(b);
+        block_release(b);
+        done += n;
+    }
+
+    if (offset + done > f->size) f->size = offset + done;
+    if (diskfs_write_inode(ino, f) != 0) return -1;
+    if (done == 0 && size > 0) return -1;
+    return done;
+}
+
+/* Set the file size, freeing or zero-filling blocks as needed */
+int diskfs_truncate(int32_t ino, file_t *f, uint32_t size) {
+    uint32_t have = file_blocks(f);
+    uint32_t nblocks = blocks_for(size);
+    if (diskfs_resize(f, nblocks) != 0) return -1;
+    for (uint32_t i = have; i < nblocks; i++) {
+        if (zero_block(f, i) != 0) return -1;
+    }
+
+    /* Keep the bytes past the end of the last block zero */
+    if (size < f->size && size % FS_BLOCK_SIZE) {
+        block_buf_t *b = block_read(file_block(f, size / FS_BLOCK_SIZE, NULL), NULL, 0);
+        if (!b) return -1;
+        uint32_t tail = size % FS_BLOCK_SIZE;
+        memory_set(b->data + tail, 0, FS_BLOCK_SIZE - tail);
+        block_mark_dirty(b);
+        block_release(b);
+    }
+
+    f->size = size;
+    return diskfs_write_inode(ino, f);
+}
+
+/* Commit every change made so far, with the superblock, to the journal */
+int diskfs_sync() {
+    if (!journal_pending()) return 0;
+
+    block_buf_t *b = block_read(0, NULL, 0);
+    if (!b) return -1;
+    memory_copy((uint8_t*)&sb, b->data, sizeof(sb));
+    int result = journal_dirty(b);
+    block_release(b);
+    if (result != 0) return -1;
+    return journal_commit();
+}
+
+/**
+ * Called before each change to the tree. A change touches at most an
+ * inode block, both bitmaps and the superblock, and must land in a
+ * single transaction, so commit the running one if it could overflow.
+ */
+void diskfs_begin() {
+    freed_expire();
+    /* A resize that fails frees the file's extents and the run it took */
+    if (journal_reserve(3 + sb.block_bitmap_blocks) ||
+        freed_count + FS_EXTENTS + 1 > DISKFS_FREED_RUNS) diskfs_sync();
+}
+
+/* Commit the running transaction once it has been open for a while */
+void diskfs_idle() {
+    if (journal_due()) diskfs_sync();
+}
+
+static int read_superblock() {
+    block_buf_t *b = block_read(0, NULL, 0);
+    if (!b) return -1;
+    memory_copy(b->data, (uint8_t*)&sb, sizeof(sb));
+    block_release(b);
+    return 0;
+}
+
+/**
+ * Read the superblock and replay the journal. Returns how many inodes
+ * the filesystem has, or
+ * -1 if there is no disk or it does not hold our filesystem.
+ */
+int32_t diskfs_mount() {
+    if (block_init() != 0) return -1;
+    if (read_superblock() != 0) return -1;
+
+    if (sb.magic != FS_MAGIC || sb.block_size != FS_BLOCK_SIZE) return -1;
+    if (sb.block_count > ata_sector_count() / BLOCK_SECTORS) return -1;
+    if (sb.version == FS_VERSION_NO_JOURNAL) {
+        journal_init(0, 0);
+    } else if (sb.version == FS_VERSION) {
+        // Replaying may rewrite the superblock itself
+        if (journal_init(sb.journal_start, sb.journal_blocks) != 0) return -1;
+        if (read_superblock() != 0) return -1;
+    } else {
+        return -1;
+    }
+    return sb.inode_count;
+}
+
+/* Load the first 'count' inodes into 'files' */
+int diskfs_load(file_t *files, int32_t count) {
+    for (int32_t i = 0; i < count; i++) {
+        block_buf_t *b = block_read(sb.inode_table + i / FS_INODES_PER_BLOCK, NULL, 0);
+        if (!b) return -1;
+        read_inode((fs_inode_t*)b->data + i % FS_INODES_PER_BLOCK, &files[i]);
+        block_release(b);
+    }
+    return 0;
+}
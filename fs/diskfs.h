@@ -0,0 +1,22 @@
+#ifndef DISKFS_H
+#define DISKFS_H
+
+#include <stdint.h>
+#include "fs.h"
+
+/* Runs freed by one transaction that are kept from reuse until it
+ * commits. diskfs_begin() commits early when they run short. */
+#define DISKFS_FREED_RUNS 32
+
+int32_t diskfs_mount();
+int diskfs_load(file_t *files, int32_t count);
+int32_t diskfs_read(file_t *f, readahead_t *ra, uint32_t offset, uint8_t *buffer, uint32_t size);
+int32_t diskfs_write(int32_t ino, file_t *f, uint32_t offset, uint8_t *buffer, uint32_t size);
+int diskfs_truncate(int32_t ino, file_t *f, uint32_t size);
+int32_t diskfs_resize(file_t *f, uint32_t nblocks);
+int diskfs_write_inode(int32_t ino, file_t *f);
+int diskfs_sync();
+void diskfs_begin();
+void diskfs_idle();
+
+#endif
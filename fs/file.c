@@ -0,0 +1,128 @@
+#include "file.h"
+#include "fs.h"
+#include "mmap.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Open-file table. A handle remembers the file, how it was opened and
+ * a position, so callers read and write a file piece by piece instead
+ * of moving the whole contents each time. There is a single task, so
+ * there is a single table; its handles are what syscalls hand out. */
+
+static open_file_t open_files[MAX_OPEN_FILES];
+
+static open_file_t *file_get(int32_t handle) {
+    if (handle < 0 || handle >= MAX_OPEN_FILES || !open_files[handle].used) return NULL;
+    return &open_files[handle];
+}
+
+/**
+ * Open 'name' in directory 'dir'. Returns a handle, or -1 if the file
+ * does not exist (and O_CREATE is not set), is a directory, or the
+ * table is full.
+ */
+int32_t file_open(char *name, int32_t dir, uint32_t flags) {
+    int32_t handle = -1;
+    for (int32_t i = 0; i < MAX_OPEN_FILES; i++) {
+        if (!open_files[i].used) {
+            handle = i;
+            break;
+        }
+    }
+    if (handle == -1) return -1;
+
+    int32_t fd = fs_open(name, dir);
+    if (fd == -1 && (flags & O_CREATE)) fd = fs_create(name, dir, 0);
+    if (fd == -1 || fs_is_dir(fd)) return -1;
+    if ((flags & O_TRUNC) && (flags & O_WRITE) && fs_truncate(fd, 0) != 0) return -1;
+
+    open_file_t *f = &open_files[handle];
+    f->used = 1;
+    f->flags = flags;
+    f->fd = fd;
+    f->pos = 0;
+    readahead_init(&f->ra);
+    return handle;
+}
+
+int file_close(int32_t handle) {
+    open_file_t *f = file_get(handle);
+    if (!f) return -1;
+    f->used = 0;
+    return 0;
+}
+
+int32_t file_pread(int32_t handle, uint8_t *buffer, uint32_t size, uint32_t offset) {
+    open_file_t *f = file_get(handle);
+    if (!f || !(f->flags & O_READ)) return -1;
+    return fs_read_stream(f->fd, offset, buffer, size, &f->ra);
+}
+
+int32_t file_pwrite(int32_t handle, uint8_t *buffer, uint32_t size, uint32_t offset) {
+    open_file_t *f = file_get(handle);
+    if (!f || !(f->flags & O_WRITE)) return -1;
+    return fs_write_at(f->fd, offset, buffer, size);
+}
+
+int32_t file_append(int32_t handle, uint8_t *buffer, uint32_t size) {
+    open_file_t *f = file_get(handle);
+    if (!f || !(f->flags & O_WRITE)) return -1;
+    return fs_write_at(f->fd, fs_get_size(f->fd), buffer, size);
+}
+
+/* Read at the current position and move past what was read */
+int32_t file_read(int32_t handle, uint8_t *buffer, uint32_t size) {
+    open_file_t *f = file_get(handle);
+    if (!f) return -1;
+    int32_t n = file_pread(handle, buffer, size, f->pos);
+    if (n > 0) f->pos += n;
+    return n;
+}
+
+int32_t file_write(int32_t handle, uint8_t *buffer, uint32_t size) {
+    open_file_t *f = file_get(handle);
+    if (!f) return -1;
+    if (f->flags & O_APPEND) f->pos = fs_get_size(f->fd);
+    int32_t n = file_pwrite(handle, buffer, size, f->pos);
+    if (n > 0) f->pos += n;
+    return n;
+}
+
+/* Move the position. Seeking past the end is allowed: a later write
+ * leaves a gap that reads as zeros. Returns the new position. */
+int32_t file_lseek(int32_t handle, int32_t offset, int whence) {
+    open_file_t *f = file_get(handle);
+    if (!f) return -1;
+
+    int32_t base;
+    if (whence == SEEK_SET) base = 0;
+    else if (whence == SEEK_CUR) base = f->pos;
+    else if (whence == SEEK_END) base = fs_get_size(f->fd);
+    else return -1;
+
+    if (base + offset < 0) return -1;
+    f->pos = base + offset;
+    return f->pos;
+}
+
+int32_t file_truncate(int32_t handle, uint32_t size) {
+    open_file_t *f = file_get(handle);
+    if (!f || !(f->flags & O_WRITE)) return -1;
+    return fs_truncate(f->fd, size);
+}
+
+/* Map an open file. A shared (writable) mapping needs O_WRITE. */
+uint32_t file_mmap(int32_t handle, uint32_t offset, uint32_t length, uint32_t flags) {
+    open_file_t *f = file_get(handle);
+    if (!f || !(f->flags & O_READ)) return 0;
+    if ((flags & MAP_SHARED) && !(f->flags & O_WRITE)) return 0;
+    return fs_mmap(f->fd, offset, length, flags);
+}
+
+/* Whether any handle refers to file table slot 'fd' */
+uint8_t file_is_open(int32_t fd) {
+    for (int32_t i = 0; i < MAX_OPEN_FILES; i++) {
+        if (open_files[i].used && open_files[i].fd == fd) return 1;
+    }
+    return 0;
+}
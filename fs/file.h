@@ -0,0 +1,41 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <stdint.h>
+#include "block.h"
+
+#define MAX_OPEN_FILES 32
+
+/* file_open flags */
+#define O_READ   0x01
+#define O_WRITE  0x02
+#define O_CREATE 0x04 // Create the file if it does not exist
+#define O_TRUNC  0x08 // Empty the file when opening it
+#define O_APPEND 0x10 // Every write goes to the end
+
+/* file_lseek whence */
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
+typedef struct {
+    uint8_t used;
+    uint32_t flags;
+    int32_t fd; // Index in the file table
+    uint32_t pos;
+    readahead_t ra; // Each handle is its own sequential stream
+} open_file_t;
+
+int32_t file_open(char *name, int32_t dir, uint32_t flags);
+int file_close(int32_t handle);
+int32_t file_read(int32_t handle, uint8_t *buffer, uint32_t size);
+int32_t file_write(int32_t handle, uint8_t *buffer, uint32_t size);
+int32_t file_pread(int32_t handle, uint8_t *buffer, uint32_t size, uint32_t offset);
+int32_t file_pwrite(int32_t handle, uint8_t *buffer, uint32_t size, uint32_t offset);
+int32_t file_append(int32_t handle, uint8_t *buffer, uint32_t size);
+int32_t file_lseek(int32_t handle, int32_t offset, int whence);
+int32_t file_truncate(int32_t handle, uint32_t size);
+uint32_t file_mmap(int32_t handle, uint32_t offset, uint32_t length, uint32_t flags);
+uint8_t file_is_open(int32_t fd);
+
+#endif
@@ -1,14 +1,134 @@
 #include "fs.h"
+#include "diskfs.h"
+#include "dcache.h"
+#include "ramfs.h"
+#include "file.h"
+#include "mmap.h"
+#include "journal.h"
+#include "../kernel/shell.h"
 #include "../libc/string.h"
 #include "../libc/mem.h"
+#include "../libc/printf.h"
 #include "../drivers/screen.h"
 #include "../drivers/vga_color.h"
+#include "../libc/function.h"
 
-file_t files[MAX_FILES];
+/* The file table grows by doubling. Unused slots are chained through
+ * 'next' so creating a file never searches for a hole. */
+file_t *files = NULL;
+static int32_t file_capacity = 0;
+static int32_t file_limit = FS_MAX_FILES;
+static int32_t free_head = -1;
+
+/* Set when the tree lives on a formatted disk instead of in RAM */
+static uint8_t mounted = 0;
+
+/* '/' has no slot of its own, so its children are indexed here */
+static dir_index_t root_children;
+
+static int fs_valid(int32_t fd) {
+    return fd >= 0 && fd < file_capacity && files[fd].used;
+}
+
+/* Child index of a directory, or NULL if 'dir' is not one */
+static dir_index_t *fs_children(int32_t dir) {
+    if (dir == -1) return &root_children;
+    if (!fs_valid(dir) || !files[dir].is_dir) return NULL;
+    return &files[dir].children;
+}
+
+static void fs_push_free(int32_t fd) {
+    files[fd].used = 0;
+    files[fd].next = free_head;
+    free_head = fd;
+}
+
+/* Make room for at least 'count' slots; new ones go on the free list */
+static int fs_reserve(int32_t count) {
+    if (count <= file_capacity) return 0;
+    if (count > file_limit) return -1;
+
+    int32_t capacity = file_capacity ? file_capacity : FS_INITIAL_FILES;
+    while (capacity < count) capacity *= 2;
+    if (capacity > file_limit) capacity = file_limit;
+
+    file_t *grown = (file_t*)krealloc((uint32_t)files, capacity * sizeof(file_t));
+    if (!grown) return -1;
+    files = grown;
+
+    /* Push in reverse so the lowest slots are handed out first */
+    for (int32_t i = capacity - 1; i >= file_capacity; i--) {
+        memory_set((uint8_t*)&files[i], 0, sizeof(file_t));
+        fs_push_free(i);
+    }
+    file_capacity = capacity;
+    return 0;
+}
+
+/* Rebuild the free list and the indexes after a mount filled the table */
+static void fs_collect_free() {
+    free_head = -1;
+    for (int32_t i = file_capacity - 1; i >= 0; i--) {
+        if (!files[i].used) fs_push_free(i);
+    }
+    dcache_rebuild(files, file_capacity);
+
+    for (int32_t i = 0; i < file_capacity; i++) {
+        dir_index_t *parent = files[i].used ? fs_children(files[i].parent_index) : NULL;
+        if (parent) dir_add(parent, files[i].name_hash, i);
+    }
+}
+
+/* Start a change to the tree. On disk it joins the running journal
+ * transaction, which is committed by fs_idle() or fs_sync(). */
+static void fs_begin() {
+    if (mounted) diskfs_begin();
+}
+
+static int32_t fs_alloc() {
+    if (free_head == -1 && fs_reserve(file_capacity + 1) != 0) return -1;
+    int32_t fd = free_head;
+    free_head = files[fd].next;
+    return fd;
+}
+
+/* 'stats': what the block cache and the journal have done since boot */
+static void stats_command(int argc, char **argv) {
+    block_stats_t *b = block_get_stats();
+    journal_stats_t *j = journal_get_stats();
+    kprintf("Block cache: %u hits, %u misses, %u blocks read ahead (%u used)\n",
+            b->hits, b->misses, b->ra_blocks, b->ra_hits);
+    kprintf("Writes: %u commands for %u blocks\n", b->writes, b->written);
+    kprintf("Journal: %u commits of %u blocks, %u checkpoints, %u replayed at mount\n",
+            j->commits, j->logged, j->checkpoints, j->replayed);
+    UNUSED(argc);
+    UNUSED(argv);
+}
 
 void init_fs() {
-    for (int i = 0; i < MAX_FILES; i++) {
-        files[i].used = 0;
+    shell_register("stats", "stats", stats_command);
+
+    // A disk has a fixed number of inodes: the table never outgrows it
+    int32_t count = diskfs_mount();
+    if (count >= 0 && count <= FS_MAX_FILES) {
+        file_limit = count;
+        if (fs_reserve(count) == 0 && diskfs_load(files, count) == 0) {
+            mounted = 1;
+            fs_collect_free();
+            kprint_info("Mounted filesystem from disk.\n");
+            return;
+        }
+        file_limit = FS_MAX_FILES;
+    }
+
+    count = initrd_count();
+    if (count >= 0 && fs_reserve(count) == 0) {
+        count = initrd_mount(files, count);
+        fs_collect_free();
+        char s[48];
+        ksnprintf(s, sizeof(s), "Loaded %d files from the initrd.\n", count);
+        kprint_info(s);
+        return;
     }
 
     // Create /home/user structure
@@ -20,130 +140,349 @@ void init_fs() {
     fs_write(fd, (uint8_t*)"Hello from the RAM filesystem!", 31);
 }
 
-int32_t fs_open(char *name, int16_t parent) {
+int32_t fs_open(char *name, int32_t parent) {
     if (strcmp(name, "..") == 0) return fs_get_parent(parent);
     if (strcmp(name, ".") == 0) return parent;
 
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (files[i].used && files[i].parent_index == parent && strcmpi(files[i].name, name) == 0) {
-            return i;
+    return dcache_lookup(files, name, parent);
+}
+
+/* Resolve 'path' starting from 'cwd', or from '/' if it is absolute.
+ * Empty components and '.' are skipped, '..' moves up and stays put at
+ * the root. Stores the result (-1 for '/') in 'fd' and returns 0, or
+ * returns -1 if a component is missing or is not a directory. */
+int fs_lookup_path(char *path, int32_t cwd, int32_t *fd) {
+    int32_t current = path[0] == '/' ? -1 : cwd;
+    char name[MAX_FILENAME];
+
+    while (*path) {
+        if (*path == '/') {
+            path++;
+            continue;
+        }
+        uint32_t len = 0;
+        while (path[len] && path[len] != '/') len++;
+        if (len >= MAX_FILENAME || !fs_children(current)) return -1;
+        memory_copy((uint8_t*)path, (uint8_t*)name, len);
+        name[len] = '\0';
+        path += len;
+
+        // Handled here: fs_open() cannot tell '..' of a top-level entry from a miss
+        if (strcmp(name, ".") == 0) continue;
+        if (strcmp(name, "..") == 0) {
+            current = fs_get_parent(current);
+            continue;
         }
+        current = dcache_lookup(files, name, current);
+        if (current == -1) return -1;
     }
-    return -1;
+
+    *fd = current;
+    return 0;
 }
 
-int32_t fs_create(char *name, int16_t parent, uint8_t is_dir) {
+/* Split 'path' into the directory holding its last component, which
+ * must exist, and that component's name, for creating and deleting */
+int fs_split_path(char *path, int32_t cwd, int32_t *parent, char *name) {
+    char dir[FS_PATH_MAX];
+    int32_t len = strlen(path);
+    if (len >= FS_PATH_MAX) return -1;
+    while (len > 1 && path[len - 1] == '/') len--;
+
+    int32_t slash = len - 1;
+    while (slash >= 0 && path[slash] != '/') slash--;
+
+    int32_t name_len = len - slash - 1;
+    if (name_len <= 0 || name_len >= MAX_FILENAME) return -1;
+    memory_copy((uint8_t*)&path[slash + 1], (uint8_t*)name, name_len);
+    name[name_len] = '\0';
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) return -1;
+
+    if (slash < 0) {
+        *parent = cwd;
+        return fs_children(cwd) ? 0 : -1;
+    }
+    // Keep the leading '/' of a top-level path
+    memory_copy((uint8_t*)path, (uint8_t*)dir, slash ? slash : 1);
+    dir[slash ? slash : 1] = '\0';
+    if (fs_lookup_path(dir, cwd, parent) != 0) return -1;
+    return fs_children(*parent) ? 0 : -1;
+}
+
+int32_t fs_create(char *name, int32_t parent, uint8_t is_dir) {
     if (fs_open(name, parent) != -1) return -1;
 
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (!files[i].used) {
-            strcpy(files[i].name, name);
-            files[i].is_dir = is_dir;
-            files[i].parent_index = parent;
-            if (!is_dir) {
-                files[i].start_addr = kmalloc(2048, 0, NULL);
-            } else {
-                files[i].start_addr = 0;
-            }
-            files[i].size = 0;
-            files[i].used = 1;
-            return i;
-        }
+    if (strlen(name) >= MAX_FILENAME) return -1;
+
+    if (!fs_children(parent)) return -1;
+
+    fs_begin();
+    int32_t i = fs_alloc();
+    if (i == -1) return -1;
+
+    // RAM files get their data pages on the first write
+    strcpy(files[i].name, name);
+    files[i].is_dir = is_dir;
+    files[i].parent_index = parent;
+    files[i].extent_count = 0;
+    files[i].cow = 0;
+    files[i].start_addr = 0;
+    files[i].blocks = NULL;
+    files[i].block_count = 0;
+    files[i].size = 0;
+    files[i].path = NULL;
+    files[i].used = 1;
+    dcache_insert(files, i);
+    // Look the parent up again: fs_alloc() may have moved the table
+    if (dir_add(fs_children(parent), files[i].name_hash, i) != 0) {
+        dcache_remove(files, i);
+        fs_push_free(i);
+        return -1;
     }
-    return -1;
+    if (mounted) diskfs_write_inode(i, &files[i]);
+    return i;
 }
 
-int32_t fs_delete(char *name, int16_t parent) {
+int32_t fs_delete(char *name, int32_t parent) {
     int32_t fd = fs_open(name, parent);
     if (fd == -1) return -1;
     
-    // If it's a directory, check if empty
-    if (files[fd].is_dir) {
-        for (int i = 0; i < MAX_FILES; i++) {
-            if (files[i].used && files[i].parent_index == fd) return -2; // Not empty
-        }
-    }
+    if (files[fd].is_dir && files[fd].children.count > 0) return -2; // Not empty
+    if (file_is_open(fd) || mmap_is_mapped(fd)) return -3;
 
+    fs_begin();
+    dir_index_t *siblings = fs_children(files[fd].parent_index);
+    if (siblings) dir_remove(siblings, files[fd].name_hash, fd);
+    dir_free(&files[fd].children);
+    kfree((uint32_t)files[fd].path);
+    files[fd].path = NULL;
+    dcache_remove(files, fd);
     files[fd].used = 0;
+    if (mounted) {
+        diskfs_resize(&files[fd], 0);
+        diskfs_write_inode(fd, &files[fd]);
+    } else {
+        ramfs_release(&files[fd]);
+    }
+    fs_push_free(fd);
     return 0;
 }
 
+static int32_t fs_write_file(int32_t fd, uint32_t offset, uint8_t *buffer, uint32_t size) {
+    if (mounted) return diskfs_write(fd, &files[fd], offset, buffer, size);
+    return ramfs_write(&files[fd], offset, buffer, size);
+}
+
+static int32_t fs_truncate_file(int32_t fd, uint32_t size) {
+    if (mounted) return diskfs_truncate(fd, &files[fd], size);
+    // Mappings point at the file's pages: they must not be freed
+    if (size < files[fd].size && mmap_is_mapped(fd)) return -1;
+    return ramfs_truncate(&files[fd], size);
+}
+
+/* Write 'size' bytes at 'offset', growing the file if needed */
+int32_t fs_write_at(int32_t fd, uint32_t offset, uint8_t *buffer, uint32_t size) {
+    if (!fs_valid(fd) || files[fd].is_dir) return -1;
+    fs_begin();
+    return fs_write_file(fd, offset, buffer, size);
+}
+
+int32_t fs_truncate(int32_t fd, uint32_t size) {
+    if (!fs_valid(fd) || files[fd].is_dir) return -1;
+    fs_begin();
+    return fs_truncate_file(fd, size);
+}
+
+/* Replace the whole contents of the file. Blocks that are still needed
+ * are overwritten in place; the rest are given back. */
 int32_t fs_write(int32_t fd, uint8_t *buffer, uint32_t size) {
-    if (fd < 0 || fd >= MAX_FILES || !files[fd].used || files[fd].is_dir) return -1;
-    
-    for (uint32_t i = 0; i < size; i++) {
-        ((uint8_t*)files[fd].start_addr)[i] = buffer[i];
+    if (!fs_valid(fd) || files[fd].is_dir) return -1;
+
+    fs_begin();
+    int32_t written = fs_write_file(fd, 0, buffer, size);
+    if (written == (int32_t)size && fs_truncate_file(fd, size) != 0) written = -1;
+    return written;
+}
+
+/* Page holding block 'index' of the file, for mmap ('write' if it will
+ * be mapped writable). A RAM file hands out its own page. A disk file
+ * is read into a new page with the mapping's read-ahead state 'ra', and
+ * 'copied' tells the caller to free it. Returns 0 past the end of the
+ * file. */
+uint32_t fs_get_page(int32_t fd, uint32_t index, uint8_t write, readahead_t *ra, uint8_t *copied) {
+    if (!fs_valid(fd) || files[fd].is_dir) return 0;
+
+    if (!mounted) {
+        *copied = 0;
+        return ramfs_page(&files[fd], index, write);
+    }
+
+    if (index * FS_BLOCK_SIZE >= files[fd].size) return 0;
+    uint32_t page = kpage_alloc();
+    if (!page) return 0;
+    if (diskfs_read(&files[fd], ra, index * FS_BLOCK_SIZE, (uint8_t*)page, FS_BLOCK_SIZE) < 0) {
+        kpage_free(page);
+        return 0;
     }
-    files[fd].size = size;
-    return size;
+    *copied = 1;
+    return page;
 }
 
 uint32_t fs_get_size(int32_t fd) {
-    if (fd < 0 || fd >= MAX_FILES || !files[fd].used) return 0;
+    if (!fs_valid(fd)) return 0;
     return files[fd].size;
 }
 
+/* Read as part of a stream whose read-ahead state is 'ra' (NULL for
+ * none). Each reader keeps its own, so readers of the same file do not
+ * break each other's sequence. */
+int32_t fs_read_stream(int32_t fd, uint32_t offset, uint8_t *buffer, uint32_t size, readahead_t *ra) {
+    if (!fs_valid(fd) || files[fd].is_dir) return -1;
+    if (mounted) return diskfs_read(&files[fd], ra, offset, buffer, size);
+    return ramfs_read(&files[fd], offset, buffer, size);
+}
+
+int32_t fs_read_at(int32_t fd, uint32_t offset, uint8_t *buffer, uint32_t size) {
+    return fs_read_stream(fd, offset, buffer, size, NULL);
+}
+
 int32_t fs_read(int32_t fd, uint8_t *buffer, uint32_t size) {
-    if (fd < 0 || fd >= MAX_FILES || !files[fd].used || files[fd].is_dir) return -1;
-    
-    uint32_t read_size = size < files[fd].size ? size : files[fd].size;
-    for (uint32_t i = 0; i < read_size; i++) {
-        buffer[i] = ((uint8_t*)files[fd].start_addr)[i];
+    return fs_read_at(fd, 0, buffer, size);
+}
+
+static void fs_print_entry(int32_t fd) {
+    if (files[fd].is_dir) kprint_color("[DIR] ", VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
+    else kprint("      ");
+    if (files[fd].is_dir) kprint_color(files[fd].name, VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
+    else kprint(files[fd].name);
+    kprint("\n");
+}
+
+/* Heapsort by name, so sorting a big directory needs no extra memory */
+static void fs_sift_down(int32_t *fds, uint32_t root, uint32_t n) {
+    while (2 * root + 1 < n) {
+        uint32_t child = 2 * root + 1;
+        if (child + 1 < n && strcmpi(files[fds[child]].name, files[fds[child + 1]].name) < 0) child++;
+        if (strcmpi(files[fds[root]].name, files[fds[child]].name) >= 0) return;
+        int32_t tmp = fds[root];
+        fds[root] = fds[child];
+        fds[child] = tmp;
+        root = child;
     }
-    return read_size;
 }
 
-void fs_list(int16_t parent) {
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (files[i].used && files[i].parent_index == parent) {
-            if (files[i].is_dir) kprint_color("[DIR] ", VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
-            else kprint("      ");
-            if (files[i].is_dir) kprint_color(files[i].name, VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
-            else kprint(files[i].name);
-            kprint("\n");
-        }
+static void fs_sort_by_name(int32_t *fds, uint32_t n) {
+    for (uint32_t i = n / 2; i > 0; i--) fs_sift_down(fds, i - 1, n);
+    for (uint32_t end = n; end > 1; end--) {
+        int32_t tmp = fds[0];
+        fds[0] = fds[end - 1];
+        fds[end - 1] = tmp;
+        fs_sift_down(fds, 0, end - 1);
     }
 }
 
-int16_t fs_get_parent(int16_t fd) {
+/* List a directory in index order, or by name if 'sorted' is set.
+ * Only the directory's own children are visited. */
+void fs_list(int32_t parent, uint8_t sorted) {
+    dir_index_t *children = fs_children(parent);
+    if (!children || children->count == 0) return;
+
+    dir_cursor_t cursor;
+    dir_cursor_init(&cursor);
+    int32_t *fds = NULL;
+    if (sorted) fds = (int32_t*)kmalloc(children->count * sizeof(int32_t), 0, NULL);
+
+    if (!fds) {
+        int32_t fd;
+        while ((fd = dir_next(children, &cursor)) != -1) fs_print_entry(fd);
+        return;
+    }
+
+    for (uint32_t i = 0; i < children->count; i++) fds[i] = dir_next(children, &cursor);
+    fs_sort_by_name(fds, children->count);
+    for (uint32_t i = 0; i < children->count; i++) fs_print_entry(fds[i]);
+    kfree((uint32_t)fds);
+}
+
+int32_t fs_get_parent(int32_t fd) {
     if (fd == -1) return -1;
-    if (fd < 0 || fd >= MAX_FILES || !files[fd].used) return -1;
+    if (!fs_valid(fd)) return -1;
     return files[fd].parent_index;
 }
 
-uint8_t fs_is_dir(int16_t fd) {
+uint8_t fs_is_dir(int32_t fd) {
     if (fd == -1) return 1; // Root is a dir
-    if (fd < 0 || fd >= MAX_FILES || !files[fd].used) return 0;
+    if (!fs_valid(fd)) return 0;
     return files[fd].is_dir;
 }
 
-char* fs_get_name(int16_t fd) {
+char* fs_get_name(int32_t fd) {
     if (fd == -1) return "/";
-    if (fd < 0 || fd >= MAX_FILES || !files[fd].used) return "";
+    if (!fs_valid(fd)) return "";
     return files[fd].name;
 }
 
-void fs_get_path(int16_t fd, char *buffer) {
-    if (fd == -1) {
+/* Canonical path of a directory. Entries are never renamed or moved,
+ * so it is built once from the parent's path and kept until the
+ * directory is deleted. Returns NULL if out of memory. */
+static char *fs_dir_path(int32_t dir) {
+    if (dir == -1) return "/";
+
+    while (!files[dir].path) {
+        // Build the outermost missing ancestor first, without recursing
+        int32_t top = dir;
+        while (files[top].parent_index != -1 && !files[files[top].parent_index].path) {
+            top = files[top].parent_index;
+        }
+        char *base = files[top].parent_index == -1 ? "" : files[files[top].parent_index].path;
+
+        char *path = (char*)kmalloc(strlen(base) + 1 + strlen(files[top].name) + 1, 0, NULL);
+        if (!path) return NULL;
+        strcpy(path, base);
+        strcat(path, "/");
+        strcat(path, files[top].name);
+        files[top].path = path;
+    }
+    return files[dir].path;
+}
+
+void fs_get_path(int32_t fd, char *buffer) {
+    if (!fs_valid(fd)) {
         strcpy(buffer, "/");
         return;
     }
 
-    int16_t current = fd;
-    
-    // Simple way to build path: build it backwards
-    
-    char parts[MAX_FILES][MAX_FILENAME];
-    int count = 0;
-    
-    while (current != -1 && count < MAX_FILES) {
-        strcpy(parts[count++], files[current].name);
-        current = files[current].parent_index;
+    // A file's path is its directory's plus its own name
+    char *dir = fs_dir_path(files[fd].is_dir ? fd : files[fd].parent_index);
+    char *name = files[fd].is_dir ? "" : files[fd].name;
+    if (!dir) {
+        strcpy(buffer, files[fd].name);
+        return;
     }
-    
-    strcpy(buffer, "/");
-    for (int i = count - 1; i >= 0; i--) {
-        strcat(buffer, parts[i]);
-        if (i > 0) strcat(buffer, "/");
+
+    uint32_t dir_len = strlen(dir);
+    uint32_t name_len = strlen(name);
+    uint32_t sep = name_len && dir_len > 1; // '/' already ends in a slash
+    uint32_t total = dir_len + sep + name_len;
+
+    // Too deep: keep the innermost part
+    uint32_t skip = total > FS_PATH_MAX - 1 ? total - (FS_PATH_MAX - 1) : 0;
+    uint32_t pos = 0;
+    for (uint32_t i = skip; i < total; i++) {
+        if (i < dir_len) buffer[pos++] = dir[i];
+        else if (i < dir_len + sep) buffer[pos++] = '/';
+        else buffer[pos++] = name[i - dir_len - sep];
     }
+    buffer[pos] = '\0';
+}
+
+/* Make sure everything written so far survives a power-off */
+void fs_sync() {
+    if (mounted) diskfs_sync();
+}
+
+/* Called while the CPU has nothing else to do: changes are grouped
+ * into one journal commit once they have waited a little */
+void fs_idle() {
+    if (mounted) diskfs_idle();
 }
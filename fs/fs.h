@@ -2,30 +2,56 @@
 #define FS_H
 
 #include <stdint.h>
+#include "ondisk.h"
+#include "block.h"
+#include "dir.h"
 
-#define MAX_FILES 16
-#define MAX_FILENAME 32
+#define FS_INITIAL_FILES 64 // The file table doubles from here as needed
+#define FS_MAX_FILES 131072
+#define MAX_FILENAME FS_NAME_LEN
+#define FS_PATH_MAX 256
 
 typedef struct {
     char name[MAX_FILENAME];
-    uint32_t start_addr;
+    uint32_t start_addr; // Initrd data, while 'cow' is set
+    uint32_t *blocks; // RAM files: one 4 KiB page per block
+    uint32_t block_count;
     uint32_t size;
     uint8_t used;
     uint8_t is_dir;
-    int16_t parent_index; // -1 for root
+    uint8_t cow; // start_addr is read-only (initrd): copy before modifying
+    int32_t parent_index; // -1 for root
+    int32_t next; // Dentry hash chain while used, free list while not
+    uint32_t name_hash; // dcache_hash(name)
+    uint16_t extent_count; // Disk files only
+    fs_extent_t extents[FS_EXTENTS];
+    dir_index_t children; // Directories only
+    char *path; // Directories: canonical path, built on first use
 } file_t;
 
 void init_fs();
-int32_t fs_open(char *name, int16_t parent);
+int32_t fs_open(char *name, int32_t parent);
+int fs_lookup_path(char *path, int32_t cwd, int32_t *fd);
+int fs_split_path(char *path, int32_t cwd, int32_t *parent, char *name);
 int32_t fs_read(int32_t fd, uint8_t *buffer, uint32_t size);
 int32_t fs_write(int32_t fd, uint8_t *buffer, uint32_t size);
-int32_t fs_create(char *name, int16_t parent, uint8_t is_dir);
-int32_t fs_delete(char *name, int16_t parent);
-void fs_list(int16_t parent);
+int32_t fs_read_at(int32_t fd, uint32_t offset, uint8_t *buffer, uint32_t size);
+int32_t fs_read_stream(int32_t fd, uint32_t offset, uint8_t *buffer, uint32_t size, readahead_t *ra);
+int32_t fs_write_at(int32_t fd, uint32_t offset, uint8_t *buffer, uint32_t size);
+int32_t fs_truncate(int32_t fd, uint32_t size);
+uint32_t fs_get_page(int32_t fd, uint32_t index, uint8_t write, readahead_t *ra, uint8_t *copied);
+int32_t fs_create(char *name, int32_t parent, uint8_t is_dir);
+int32_t fs_delete(char *name, int32_t parent);
+void fs_list(int32_t parent, uint8_t sorted);
 uint32_t fs_get_size(int32_t fd);
-int16_t fs_get_parent(int16_t fd);
-uint8_t fs_is_dir(int16_t fd);
-char* fs_get_name(int16_t fd);
-void fs_get_path(int16_t fd, char *buffer);
+int32_t fs_get_parent(int32_t fd);
+uint8_t fs_is_dir(int32_t fd);
+char* fs_get_name(int32_t fd);
+void fs_get_path(int32_t fd, char *buffer);
+void fs_sync();
+void fs_idle();
+
+int32_t initrd_count();
+int32_t initrd_mount(file_t *files, int32_t max_files);
 
 #endif
@@ -0,0 +1,59 @@
+#include "initrd.h"
+#include "fs.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Defined in boot/initrd.asm */
+extern uint8_t initrd_start[];
+extern uint8_t initrd_end[];
+
+/* Number of entries in the archive, or -1 if there is none */
+int32_t initrd_count() {
+    initrd_header_t *header = (initrd_header_t*)initrd_start;
+    uint32_t available = initrd_end - initrd_start;
+
+    if (available < sizeof(initrd_header_t) || header->magic != INITRD_MAGIC) return -1;
+    if (header->size > available ||
+        sizeof(initrd_header_t) + header->count * sizeof(initrd_entry_t) > header->size) {
+        return -1;
+    }
+    return header->count;
+}
+
+/**
+ * Expose the archive linked into the kernel image as the RAM tree.
+ * Nothing is copied: a file's data points straight into the archive
+ * and is marked copy-on-write, so it only gets its own buffer the
+ * first time it is written.
+ * Returns how many entries were loaded, or -1 if there is no archive.
+ */
+int32_t initrd_mount(file_t *files, int32_t max_files) {
+    if (initrd_count() < 0) return -1;
+
+    initrd_header_t *header = (initrd_header_t*)initrd_start;
+    initrd_entry_t *entries = (initrd_entry_t*)(header + 1);
+    int32_t count = 0;
+
+    /* Parents come first, so entry i can simply become slot i */
+    for (uint32_t i = 0; i < header->count && count < max_files; i++) {
+        initrd_entry_t *e = &entries[i];
+        file_t *f = &files[count];
+        if (e->parent >= count || e->offset + e->size > header->size) break;
+
+        memory_set((uint8_t*)f, 0, sizeof(file_t));
+        memory_copy((uint8_t*)e->name, (uint8_t*)f->name, FS_NAME_LEN);
+        f->name[FS_NAME_LEN - 1] = '\0';
+        f->parent_index = e->parent;
+        f->is_dir = (e->flags & INITRD_DIR) ? 1 : 0;
+        if (!f->is_dir) {
+            f->start_addr = (uint32_t)initrd_start + e->offset;
+            f->size = e->size;
+            f->cow = 1;
+        }
+        f->used = 1;
+        count++;
+    }
+    return count;
+}
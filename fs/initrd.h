@@ -0,0 +1,35 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+/* Initial ramdisk archive, shared by the kernel and tools/mkinitrd.
+ *
+ * header | entries[count] | file data
+ *
+ * Entries are stored parents first, each naming its parent by entry
+ * index (-1 for '/'). File data is page aligned, zero padded and
+ * referenced by offset from the start of the archive, so the kernel can
+ * point files straight into it and map its pages. */
+
+#include <stdint.h>
+#include "ondisk.h"
+
+#define INITRD_MAGIC 0x44524E49 /* "INRD" */
+#define INITRD_ALIGN 4096
+
+#define INITRD_DIR 0x01
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t size;
+} __attribute__((packed)) initrd_header_t;
+
+typedef struct {
+    char name[FS_NAME_LEN];
+    int32_t parent;
+    uint32_t flags;
+    uint32_t offset;
+    uint32_t size;
+} __attribute__((packed)) initrd_entry_t;
+
+#endif
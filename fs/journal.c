@@ -0,0 +1,302 @@
+#include "journal.h"
+#include "ondisk.h"
+#include "../cpu/timer.h"
+#include "../drivers/ata.h"
+#include "../libc/mem.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Write-ahead journal for the disk filesystem's metadata.
+ * A metadata buffer that is changed joins the running transaction and
+ * is pinned in the block cache: it stays dirty but is not written in
+ * place. Committing writes the whole transaction to the log in one
+ * sequential burst (descriptor, blocks, commit) followed by a single
+ * cache flush; after that the buffers are ordinary dirty blocks again.
+ * Many operations share a transaction, so a burst of small changes
+ * costs one log write instead of several scattered ones each.
+ *
+ * When the log could not take another full transaction it is
+ * checkpointed: every committed block is written home and the header
+ * is moved past them. That is done right after a commit, while nothing
+ * is pinned: a pinned buffer may also hold changes of an earlier
+ * transaction, which would leave the log without reaching home. At
+ * mount, committed transactions still in the log are replayed in
+ * order. */
+
+static uint32_t log_start = 0;
+static uint32_t log_blocks = 0; /* 0: no journal, changes go straight home */
+static uint32_t sequence = 1;   /* Sequence of the next transaction */
+static uint32_t log_pos = 1;    /* Where it will be written */
+
+static block_buf_t *running[JOURNAL_MAX_BLOCKS];
+static uint32_t running_count = 0;
+static uint32_t opened = 0; /* Tick the running transaction started at */
+static uint32_t held = 0;   /* Buffers left pinned outside any transaction */
+static uint32_t synced = 0; /* Cache write count at the last flush to the platter */
+
+static fs_journal_block_t *desc;   /* Descriptor being built */
+static fs_journal_block_t *commit; /* Commit block being built */
+static journal_stats_t stats;
+
+/* Data of each block of a log write, in disk order */
+static uint8_t *log_data[JOURNAL_MAX_BLOCKS + 2];
+
+static uint8_t *log_sector_buffer(ata_request_t *req, uint16_t sector) {
+    uint8_t **run = (uint8_t**)req->private;
+    return run[sector / BLOCK_SECTORS] + (sector % BLOCK_SECTORS) * ATA_SECTOR_SIZE;
+}
+
+static uint32_t checksum(uint32_t sum, uint8_t *data, uint32_t size) {
+    uint32_t *words = (uint32_t*)data;
+    for (uint32_t i = 0; i < size / 4; i++) sum = (sum ^ words[i]) * 16777619;
+    return sum;
+}
+
+static int log_read(uint32_t pos, void *buffer) {
+    return ata_read((log_start + pos) * BLOCK_SECTORS, BLOCK_SECTORS, (uint8_t*)buffer);
+}
+
+/* Write 'count' blocks of 'log_data' at 'pos', in as few commands as possible */
+static int log_write(uint32_t pos, uint32_t count) {
+    uint32_t done = 0;
+    while (done < count) {
+        uint32_t n = count - done;
+        if (n > BLOCK_RUN_MAX) n = BLOCK_RUN_MAX;
+
+        ata_request_t req;
+        req.lba = (log_start + pos + done) * BLOCK_SECTORS;
+        req.count = n * BLOCK_SECTORS;
+        req.write = 1;
+        req.sector_buffer = log_sector_buffer;
+        req.complete = NULL;
+        req.private = &log_data[done];
+        if (ata_submit(&req) != 0 || ata_wait(&req) != 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+/* Point the header at 'sequence': everything before it is home */
+static int write_header() {
+    memory_set((uint8_t*)desc, 0, FS_BLOCK_SIZE);
+    desc->magic = FS_JOURNAL_MAGIC;
+    desc->type = FS_JOURNAL_HEADER;
+    desc->sequence = sequence;
+    log_data[0] = (uint8_t*)desc;
+    if (log_write(0, 1) != 0) return -1;
+    return ata_flush();
+}
+
+/* Make every block written through the cache so far durable, if any
+ * was: the drive may otherwise keep it in its write cache behind a
+ * commit block written later */
+static int sync_written() {
+    uint32_t writes = block_get_stats()->writes;
+    if (writes == synced) return 0;
+    if (ata_flush() != 0) return -1;
+    synced = writes;
+    return 0;
+}
+
+/* Write every committed block home and empty the log. Nothing may be
+ * pinned. */
+static int checkpoint() {
+    if (block_flush() != 0 || sync_written() != 0) return -1;
+    if (write_header() != 0) return -1;
+    log_pos = 1;
+    stats.checkpoints++;
+    return 0;
+}
+
+/**
+ * Write the running transaction to the log. Data blocks are flushed
+ * first, and reach the disk before the commit does, so committed
+ * metadata never points at stale data.
+ */
+int journal_commit() {
+    if (running_count == 0) return 0;
+
+    if (!log_blocks) {
+        running_count = 0;
+        sequence++;
+        if (block_flush() != 0) return -1;
+        return ata_flush();
+    }
+
+    /* Pinned buffers are skipped: this writes data and older metadata.
+     * The log has room: the last commit made sure of it. */
+    if (block_flush() != 0 || sync_written() != 0) return -1;
+    if (log_pos + running_count + 2 > log_blocks) return -1;
+
+    memory_set((uint8_t*)desc, 0, FS_BLOCK_SIZE);
+    desc->magic = FS_JOURNAL_MAGIC;
+    desc->type = FS_JOURNAL_DESCRIPTOR;
+    desc->sequence = sequence;
+    desc->count = running_count;
+    for (uint32_t i = 0; i < running_count; i++) desc->blocks[i] = running[i]->blockno;
+
+    uint32_t sum = checksum(0x811C9DC5, (uint8_t*)desc, FS_BLOCK_SIZE);
+    log_data[0] = (uint8_t*)desc;
+    for (uint32_t i = 0; i < running_count; i++) {
+        log_data[i + 1] = running[i]->data;
+        sum = checksum(sum, running[i]->data, FS_BLOCK_SIZE);
+    }
+
+    memory_set((uint8_t*)commit, 0, FS_BLOCK_SIZE);
+    commit->magic = FS_JOURNAL_MAGIC;
+    commit->type = FS_JOURNAL_COMMIT;
+    commit->sequence = sequence;
+    commit->count = running_count;
+    commit->checksum = sum;
+    log_data[running_count + 1] = (uint8_t*)commit;
+
+    /* The checksum lets the commit block go out with the rest */
+    if (log_write(log_pos, running_count + 2) != 0 || ata_flush() != 0) return -1;
+
+    for (uint32_t i = 0; i < running_count; i++) {
+        running[i]->flags &= ~B_PINNED;
+        block_release(running[i]);
+    }
+    log_pos += running_count + 2;
+    sequence++;
+    stats.commits++;
+    stats.logged += running_count;
+    running_count = 0;
+
+    /* Nothing is pinned now: empty the log if the next transaction
+     * might not fit. Held buffers would lose their logged changes. */
+    if (log_pos + JOURNAL_MAX_BLOCKS + 2 > log_blocks) return held ? -1 : checkpoint();
+    return 0;
+}
+
+/**
+ * Record that metadata buffer 'b' was changed. It is kept in the cache
+ * until its transaction commits. A transaction that fills up commits
+ * there and then, so callers reserve room with journal_reserve() before
+ * making a change that must stay atomic. Returns -1 if the change could
+ * not be logged.
+ */
+int journal_dirty(block_buf_t *b) {
+    if (!log_blocks) {
+        block_mark_dirty(b);
+        if (running_count == 0) opened = tick;
+        running_count = 1; /* Only remembers there is something to sync */
+        return 0;
+    }
+    if (b->flags & B_PINNED) return 0;
+
+    /* Pinned before anything else is written: it holds the change */
+    b->flags |= B_PINNED;
+    b->refcnt++;
+    block_mark_dirty(b);
+
+    /* Still full after a failed commit. The buffer stays pinned for
+     * good, so its change never goes home unlogged. */
+    if (running_count == JOURNAL_MAX_BLOCKS) {
+        held++;
+        return -1;
+    }
+
+    if (running_count == 0) opened = tick;
+    running[running_count++] = b;
+    if (running_count == JOURNAL_MAX_BLOCKS) return journal_commit();
+    return 0;
+}
+
+/* Returns nonzero if the running transaction must be committed
+ * before a change touching up to 'nblocks' metadata blocks */
+int journal_reserve(uint32_t nblocks) {
+    return log_blocks && running_count + nblocks > JOURNAL_MAX_BLOCKS;
+}
+
+uint8_t journal_pending() {
+    return running_count > 0;
+}
+
+/* Sequence of the running transaction; moves on with each commit */
+uint32_t journal_sequence() {
+    return sequence;
+}
+
+/* A transaction is open and has waited long enough */
+uint8_t journal_due() {
+    return running_count > 0 && tick - opened >= JOURNAL_COMMIT_TICKS;
+}
+
+journal_stats_t *journal_get_stats() {
+    return &stats;
+}
+
+/**
+ * Check transaction 'sequence' at 'pos' and, if it was committed, copy its
+ * blocks home through the cache. 'data' is a scratch block.
+ */
+static int replay_one(uint32_t pos, uint8_t *data) {
+    if (log_read(pos, desc) != 0) return -1;
+    if (desc->magic != FS_JOURNAL_MAGIC || desc->type != FS_JOURNAL_DESCRIPTOR ||
+        desc->sequence != sequence || desc->count == 0 ||
+        desc->count > JOURNAL_MAX_BLOCKS || pos + desc->count + 2 > log_blocks) {
+        return -1;
+    }
+
+    uint32_t sum = checksum(0x811C9DC5, (uint8_t*)desc, FS_BLOCK_SIZE);
+    for (uint32_t i = 0; i < desc->count; i++) {
+        if (log_read(pos + 1 + i, data) != 0) return -1;
+        sum = checksum(sum, data, FS_BLOCK_SIZE);
+    }
+    if (log_read(pos + 1 + desc->count, commit) != 0) return -1;
+    if (commit->magic != FS_JOURNAL_MAGIC || commit->type != FS_JOURNAL_COMMIT ||
+        commit->sequence != sequence || commit->count != desc->count ||
+        commit->checksum != sum) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < desc->count; i++) {
+        block_buf_t *b = block_get(desc->blocks[i]);
+        if (!b || log_read(pos + 1 + i, b->data) != 0) {
+            block_release(b);
+            return -1;
+        }
+        block_mark_dirty(b);
+        block_release(b);
+    }
+    return 0;
+}
+
+/**
+ * Use the log in blocks [start, start + nblocks). Committed
+ * transactions left in it are replayed and the log is emptied.
+ * With 'nblocks' 0 there is no journal and changes are written home
+ * directly. Returns -1 if the log is unusable.
+ */
+int journal_init(uint32_t start, uint32_t nblocks) {
+    log_start = start;
+    log_blocks = 0;
+    running_count = 0;
+    if (nblocks == 0) return 0;
+    if (nblocks < FS_JOURNAL_MIN_BLOCKS) return -1;
+
+    if (!desc) {
+        desc = (fs_journal_block_t*)kpage_alloc();
+        commit = (fs_journal_block_t*)kpage_alloc();
+    }
+    uint8_t *data = (uint8_t*)kpage_alloc();
+    if (!desc || !commit || !data) return -1;
+
+    log_blocks = nblocks;
+    int result = -1;
+    if (log_read(0, desc) == 0 && desc->magic == FS_JOURNAL_MAGIC &&
+        desc->type == FS_JOURNAL_HEADER) {
+        sequence = desc->sequence;
+        uint32_t pos = 1;
+        while (pos < log_blocks && replay_one(pos, data) == 0) {
+            pos += desc->count + 2;
+            sequence++;
+            stats.replayed++;
+        }
+        result = checkpoint();
+    }
+    kpage_free((uint32_t)data);
+    if (result != 0) log_blocks = 0;
+    return result;
+}
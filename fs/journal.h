@@ -0,0 +1,30 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include "block.h"
+
+/* Most metadata blocks in one transaction. Their buffers cannot be
+ * evicted until it commits, so this leaves half the cache free. */
+#define JOURNAL_MAX_BLOCKS (BLOCK_CACHE_SIZE / 2)
+
+/* A transaction left open this long is committed when the CPU is idle */
+#define JOURNAL_COMMIT_TICKS 10
+
+typedef struct {
+    uint32_t commits;     /* Transactions written to the log */
+    uint32_t logged;      /* Blocks logged by them */
+    uint32_t checkpoints; /* Times the log was emptied */
+    uint32_t replayed;    /* Transactions replayed at mount */
+} journal_stats_t;
+
+int journal_init(uint32_t start, uint32_t nblocks);
+int journal_dirty(block_buf_t *b);
+int journal_reserve(uint32_t nblocks);
+int journal_commit();
+uint8_t journal_pending();
+uint32_t journal_sequence();
+uint8_t journal_due();
+journal_stats_t *journal_get_stats();
+
+#endif
@@ -0,0 +1,151 @@
+#include "mmap.h"
+#include "fs.h"
+#include "../cpu/isr.h"
+#include "../cpu/paging.h"
+#include "../drivers/screen.h"
+#include "../libc/mem.h"
+#include "../libc/string.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* File mappings. fs_mmap only reserves a virtual range: pages are mapped
+ * by the page fault handler the first time they are touched. Without a
+ * disk a RAM file's data is already made of pages, so the mapping points
+ * straight at them and nothing is ever copied. With a disk each page is
+ * read once into a private page, and shared mappings write back the
+ * pages that got dirty when they are unmapped. */
+
+static mapping_t mappings[MAX_MAPPINGS];
+
+static mapping_t *mmap_find(uint32_t addr) {
+    for (int i = 0; i < MAX_MAPPINGS; i++) {
+        mapping_t *m = &mappings[i];
+        if (m->used && addr >= m->base && addr < m->base + m->pages * PAGE_SIZE) return m;
+    }
+    return NULL;
+}
+
+/* Whether [addr, addr + size) lies inside one mapping, one the kernel
+ * can write through if 'write'. Its pages may be absent: touching them
+ * from the kernel brings them in like a user access. */
+uint8_t mmap_range_ok(uint32_t addr, uint32_t size, uint8_t write) {
+    mapping_t *m = mmap_find(addr);
+    if (!m || addr + size < addr || addr + size > m->base + m->pages * PAGE_SIZE) return 0;
+    return !write || (m->flags & MAP_SHARED);
+}
+
+/* First free virtual range of 'pages' pages, or 0 */
+static uint32_t mmap_find_space(uint32_t pages) {
+    uint32_t base = MMAP_BASE;
+    int moved = 1;
+    while (moved) {
+        moved = 0;
+        for (int i = 0; i < MAX_MAPPINGS; i++) {
+            mapping_t *m = &mappings[i];
+            uint32_t end = m->base + m->pages * PAGE_SIZE;
+            if (m->used && base < end && base + pages * PAGE_SIZE > m->base) {
+                base = end;
+                moved = 1;
+            }
+        }
+    }
+    if (base + pages * PAGE_SIZE > MMAP_END || base + pages * PAGE_SIZE < base) return 0;
+    return base;
+}
+
+/**
+ * Map 'length' bytes of the file from 'offset' (page aligned). The
+ * length is cut to the end of the file. Returns the address, or 0.
+ */
+uint32_t fs_mmap(int32_t fd, uint32_t offset, uint32_t length, uint32_t flags) {
+    uint32_t size = fs_get_size(fd);
+    if (offset % PAGE_SIZE || length == 0 || fs_is_dir(fd) || offset >= size) return 0;
+    if (length > size - offset) length = size - offset;
+
+    mapping_t *m = NULL;
+    for (int i = 0; i < MAX_MAPPINGS && !m; i++) {
+        if (!mappings[i].used) m = &mappings[i];
+    }
+    if (!m) return 0;
+
+    uint32_t pages = (length + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t base = mmap_find_space(pages);
+    if (!base) return 0;
+
+    m->used = 1;
+    m->copied = 0;
+    m->flags = flags;
+    m->fd = fd;
+    m->base = base;
+    m->offset = offset;
+    m->pages = pages;
+    readahead_init(&m->ra);
+    return base;
+}
+
+int fs_munmap(uint32_t addr) {
+    mapping_t *m = mmap_find(addr);
+    if (!m || m->base != addr) return -1;
+
+    for (uint32_t i = 0; i < m->pages; i++) {
+        uint32_t entry = paging_unmap(m->base + i * PAGE_SIZE);
+        if (!(entry & PAGE_PRESENT) || !m->copied) continue;
+
+        uint32_t page = entry & ~0xFFF;
+        uint32_t pos = m->offset + i * PAGE_SIZE;
+        uint32_t size = fs_get_size(m->fd);
+        if ((m->flags & MAP_SHARED) && (entry & PAGE_DIRTY) && pos < size) {
+            uint32_t n = size - pos < PAGE_SIZE ? size - pos : PAGE_SIZE;
+            fs_write_at(m->fd, pos, (uint8_t*)page, n);
+        }
+        kpage_free(page);
+    }
+    m->used = 0;
+    return 0;
+}
+
+/* Whether 'addr' starts a mapping that user mode asked for */
+uint8_t mmap_is_user(uint32_t addr) {
+    mapping_t *m = mmap_find(addr);
+    return m && m->base == addr && (m->flags & MAP_USER);
+}
+
+uint8_t mmap_is_mapped(int32_t fd) {
+    for (int i = 0; i < MAX_MAPPINGS; i++) {
+        if (mappings[i].used && mappings[i].fd == fd) return 1;
+    }
+    return 0;
+}
+
+static void page_fault_handler(registers_t *r) {
+    uint32_t addr;
+    asm volatile("mov %%cr2, %0" : "=r"(addr));
+
+    /* Error code: bit 0 set if the page was present, bit 1 on a write */
+    mapping_t *m = mmap_find(addr);
+    int write = r->err_code & 0x2;
+    if (m && !(r->err_code & 0x1) && (!write || (m->flags & MAP_SHARED))) {
+        uint32_t index = (addr - m->base) / PAGE_SIZE;
+        uint8_t copied = 0;
+        uint32_t page = fs_get_page(m->fd, m->offset / PAGE_SIZE + index,
+                                    (m->flags & MAP_SHARED) != 0, &m->ra, &copied);
+        if (page) {
+            uint32_t flags = PAGE_PRESENT;
+            if (m->flags & MAP_SHARED) flags |= PAGE_WRITE;
+            if (m->flags & MAP_USER) flags |= PAGE_USER;
+            if (paging_map(m->base + index * PAGE_SIZE, page, flags) == 0) {
+                m->copied = copied;
+                return;
+            }
+            if (copied) kpage_free(page);
+        }
+    }
+
+    kprintf("Page fault at 0x%x (%s)\n", addr, write ? "write" : "read");
+    asm volatile("cli");
+    for (;;) asm volatile("hlt");
+}
+
+void init_mmap() {
+    register_interrupt_handler(14, page_fault_handler);
+}
@@ -0,0 +1,35 @@
+#ifndef MMAP_H
+#define MMAP_H
+
+#include <stdint.h>
+#include "block.h"
+
+/* Virtual range for file mappings, above the identity mapped memory */
+#define MMAP_BASE 0x40000000
+#define MMAP_END  0x80000000
+#define MAX_MAPPINGS 32
+
+/* fs_mmap flags */
+#define MAP_READ   0x01 // Read-only
+#define MAP_SHARED 0x02 // Writable, and writes reach the file
+#define MAP_USER   0x04 // Accessible from user mode
+
+typedef struct {
+    uint8_t used;
+    uint8_t copied; // Pages are private copies, not the file's own
+    uint32_t flags;
+    int32_t fd;
+    uint32_t base;
+    uint32_t offset; // In the file, page aligned
+    uint32_t pages;
+    readahead_t ra; // Faults on disk files read ahead like a reader
+} mapping_t;
+
+void init_mmap();
+uint32_t fs_mmap(int32_t fd, uint32_t offset, uint32_t length, uint32_t flags);
+int fs_munmap(uint32_t addr);
+uint8_t mmap_is_mapped(int32_t fd);
+uint8_t mmap_is_user(uint32_t addr);
+uint8_t mmap_range_ok(uint32_t addr, uint32_t size, uint8_t write);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef ONDISK_H
+#define ONDISK_H
+
+/* On-disk filesystem format, shared by the kernel and tools/mkfs.
+ *
+ * Block 0                superblock
+ * inode_bitmap ...       one bit per inode
+ * block_bitmap ...       one bit per block (metadata blocks are marked used)
+ * inode_table ...        FS_INODES_PER_BLOCK inodes per block
+ * journal_start ...      metadata journal (version 2 and later)
+ * data_start ...         file data, addressed by extents
+ *
+ * Like the RAM filesystem, there are no directory entries: every inode
+ * carries its own name and the inode number of its parent. */
+
+#include <stdint.h>
+
+#define FS_MAGIC 0x464D4553 /* "SEMF" */
+#define FS_VERSION 2
+#define FS_VERSION_NO_JOURNAL 1 /* Still mounted, without a journal */
+#define FS_BLOCK_SIZE 4096
+#define FS_BITS_PER_BLOCK (FS_BLOCK_SIZE * 8)
+#define FS_NAME_LEN 32
+#define FS_EXTENTS 10
+#define FS_INODE_SIZE 128
+#define FS_INODES_PER_BLOCK (FS_BLOCK_SIZE / FS_INODE_SIZE)
+#define FS_ROOT_PARENT -1
+
+/* Inode flags */
+#define FS_INODE_USED 0x01
+#define FS_INODE_DIR  0x02
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t block_count;
+    uint32_t inode_count;
+    uint32_t inode_bitmap;
+    uint32_t block_bitmap;
+    uint32_t block_bitmap_blocks;
+    uint32_t inode_table;
+    uint32_t inode_table_blocks;
+    uint32_t data_start;
+    uint32_t free_blocks;
+    uint32_t journal_start;
+    uint32_t journal_blocks;
+} __attribute__((packed)) fs_superblock_t;
+
+/* 'length' contiguous blocks starting at block 'start' */
+typedef struct {
+    uint32_t start;
+    uint32_t length;
+} __attribute__((packed)) fs_extent_t;
+
+typedef struct {
+    char name[FS_NAME_LEN];
+    uint32_t size;
+    int32_t parent;
+    uint16_t flags;
+    uint16_t extent_count;
+    fs_extent_t extents[FS_EXTENTS];
+    uint8_t reserved[4];
+} __attribute__((packed)) fs_inode_t;
+
+/* The journal is a write-ahead log of whole metadata blocks (bitmaps,
+ * inode table, superblock). Its first block is a header giving the
+ * sequence number of the oldest transaction that may still need
+ * replaying; transactions follow from the next block on:
+ *
+ *   descriptor   home block number of each logged block
+ *   blocks ...   new contents of those blocks
+ *   commit       checksum over the descriptor and the blocks
+ *
+ * A transaction counts only if its commit block matches, so one torn
+ * by a power-off is ignored. Replaying is idempotent. */
+
+#define FS_JOURNAL_MAGIC 0x4C4E524A /* "JRNL" */
+#define FS_JOURNAL_MIN_BLOCKS 64
+
+/* Journal block types */
+#define FS_JOURNAL_HEADER     1
+#define FS_JOURNAL_DESCRIPTOR 2
+#define FS_JOURNAL_COMMIT     3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t sequence;
+    uint32_t count;    /* Blocks in the transaction */
+    uint32_t checksum; /* Commit blocks only */
+    uint32_t blocks[]; /* Descriptor blocks only */
+} __attribute__((packed)) fs_journal_block_t;
+
+#define FS_JOURNAL_DESC_MAX ((FS_BLOCK_SIZE - sizeof(fs_journal_block_t)) / sizeof(uint32_t))
+
+#endif
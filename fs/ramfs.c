@@ -0,0 +1,161 @@
+#include "ramfs.h"
+#include "../libc/mem.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* File data when there is no disk. A file is a table of 4 KiB pages,
+ * one per block, so it can grow to megabytes without ever being copied
+ * and shrinking hands pages straight back to the allocator. Pages come
+ * zeroed, and the bytes past the end of the last block are kept zero,
+ * so growing a file never exposes old data.
+ *
+ * Files from the initrd start out pointing into the archive ('cow') and
+ * only get pages of their own when they are first modified. */
+
+static uint32_t min(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+static uint32_t blocks_for(uint32_t size) {
+    return (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+}
+
+/* The page table is sized to a power of two, so growing a file one
+ * block at a time only reallocates it log(n) times */
+static uint32_t table_size(uint32_t nblocks) {
+    uint32_t n = 4;
+    while (n < nblocks) n *= 2;
+    return n * sizeof(uint32_t);
+}
+
+static int ramfs_resize(file_t *f, uint32_t nblocks) {
+    uint32_t original = f->block_count;
+
+    if (nblocks > f->block_count) {
+        uint32_t *table = (uint32_t*)krealloc((uint32_t)f->blocks, table_size(nblocks));
+        if (!table) return -1;
+        f->blocks = table;
+        while (f->block_count < nblocks) {
+            uint32_t page = kpage_alloc();
+            if (!page) {
+                ramfs_resize(f, original);
+                return -1;
+            }
+            f->blocks[f->block_count++] = page;
+        }
+        return 0;
+    }
+
+    while (f->block_count > nblocks) kpage_free(f->blocks[--f->block_count]);
+    if (f->block_count == 0) {
+        kfree((uint32_t)f->blocks);
+        f->blocks = NULL;
+    }
+    return 0;
+}
+
+/* Copy an initrd file into pages of its own */
+static int ramfs_unshare(file_t *f) {
+    uint8_t *data = (uint8_t*)f->start_addr;
+    if (ramfs_resize(f, blocks_for(f->size)) != 0) return -1;
+
+    for (uint32_t i = 0; i < f->block_count; i++) {
+        uint32_t n = min(FS_BLOCK_SIZE, f->size - i * FS_BLOCK_SIZE);
+        memory_copy(data + i * FS_BLOCK_SIZE, (uint8_t*)f->blocks[i], n);
+    }
+    f->start_addr = 0;
+    f->cow = 0;
+    return 0;
+}
+
+int32_t ramfs_read(file_t *f, uint32_t offset, uint8_t *buffer, uint32_t size) {
+    if (offset >= f->size) return 0;
+    size = min(size, f->size - offset);
+
+    if (f->cow) {
+        memory_copy((uint8_t*)f->start_addr + offset, buffer, size);
+        return size;
+    }
+
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t pos = offset + done;
+        uint32_t in_block = pos % FS_BLOCK_SIZE;
+        uint32_t n = min(FS_BLOCK_SIZE - in_block, size - done);
+        memory_copy((uint8_t*)f->blocks[pos / FS_BLOCK_SIZE] + in_block, buffer + done, n);
+        done += n;
+    }
+    return done;
+}
+
+/* Write 'size' bytes at 'offset', growing the file if needed. A write
+ * past the end leaves a zero-filled gap. */
+int32_t ramfs_write(file_t *f, uint32_t offset, uint8_t *buffer, uint32_t size) {
+    uint32_t end = offset + size;
+    if (end < offset) return -1;
+    if (f->cow && ramfs_unshare(f) != 0) return -1;
+    if (blocks_for(end) > f->block_count && ramfs_resize(f, blocks_for(end)) != 0) return -1;
+
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t pos = offset + done;
+        uint32_t in_block = pos % FS_BLOCK_SIZE;
+        uint32_t n = min(FS_BLOCK_SIZE - in_block, size - done);
+        memory_copy(buffer + done, (uint8_t*)f->blocks[pos / FS_BLOCK_SIZE] + in_block, n);
+        done += n;
+    }
+
+    if (end > f->size) f->size = end;
+    return size;
+}
+
+int ramfs_truncate(file_t *f, uint32_t size) {
+    if (f->cow) {
+        /* The archive can stay shared for as long as the file only shrinks */
+        if (size <= f->size) {
+            f->size = size;
+            return 0;
+        }
+        if (ramfs_unshare(f) != 0) return -1;
+    }
+
+    if (ramfs_resize(f, blocks_for(size)) != 0) return -1;
+    if (size < f->size && size % FS_BLOCK_SIZE) {
+        uint32_t tail = size % FS_BLOCK_SIZE;
+        memory_set((uint8_t*)f->blocks[size / FS_BLOCK_SIZE] + tail, 0, FS_BLOCK_SIZE - tail);
+    }
+    f->size = size;
+    return 0;
+}
+
+/* Give back every page of a file that is being deleted */
+void ramfs_release(file_t *f) {
+    if (!f->cow) ramfs_resize(f, 0);
+    f->start_addr = 0;
+    f->cow = 0;
+    f->size = 0;
+}
+
+/* Whether block 'index' of an initrd file can be mapped straight from
+ * the archive: it must be page aligned, and show only zeros past the
+ * end of the file, which may have been cut short since */
+static int ramfs_shareable(file_t *f, uint32_t index) {
+    uint8_t *page = (uint8_t*)f->start_addr + index * FS_BLOCK_SIZE;
+    if ((uint32_t)page % FS_BLOCK_SIZE) return 0;
+    for (uint32_t i = f->size - index * FS_BLOCK_SIZE; i < FS_BLOCK_SIZE; i++) {
+        if (page[i]) return 0;
+    }
+    return 1;
+}
+
+/* Page holding block 'index' of the file, for mmap. An initrd file
+ * lends the archive's own page to a mapping that only reads, and is
+ * copied into pages of its own first, once, for one that 'write's. */
+uint32_t ramfs_page(file_t *f, uint32_t index, uint8_t write) {
+    if (f->cow && !write && index < blocks_for(f->size) && ramfs_shareable(f, index)) {
+        return f->start_addr + index * FS_BLOCK_SIZE;
+    }
+    if (f->cow && ramfs_unshare(f) != 0) return 0;
+    if (index >= f->block_count) return 0;
+    return f->blocks[index];
+}
@@ -0,0 +1,13 @@
+#ifndef RAMFS_H
+#define RAMFS_H
+
+#include <stdint.h>
+#include "fs.h"
+
+int32_t ramfs_read(file_t *f, uint32_t offset, uint8_t *buffer, uint32_t size);
+int32_t ramfs_write(file_t *f, uint32_t offset, uint8_t *buffer, uint32_t size);
+int ramfs_truncate(file_t *f, uint32_t size);
+void ramfs_release(file_t *f);
+uint32_t ramfs_page(file_t *f, uint32_t index, uint8_t write);
+
+#endif
@@ -0,0 +1,314 @@
+#include "bench.h"
+#include "editor.h"
+#include "input.h"
+#include "shell.h"
+#include "../cpu/timer.h"
+#include "../drivers/screen.h"
+#include "../drivers/serial.h"
+#include "../fs/fs.h"
+#include "../fs/journal.h"
+#include "../libc/string.h"
+#include "../libc/mem.h"
+#include "../libc/printf.h"
+#include "../libc/function.h"
+#include <stdint.h>
+
+/* Micro-benchmarks run from the shell. Commands execute inside the
+ * keyboard interrupt, so everything is timed with the TSC. */
+
+static void bench_report(char *what, uint32_t ops, uint64_t cycles) {
+    kprintf("  %s: %u ops in %u ms", what, ops, timer_cycles_to_us(cycles) / 1000);
+    if (ops) kprintf(", %u cycles/op", (uint32_t)udiv64(cycles, ops));
+    kprint("\n");
+}
+
+static void bench_report_rate(char *what, uint32_t bytes, uint64_t cycles) {
+    uint32_t us = timer_cycles_to_us(cycles);
+    kprintf("  %s: %u KiB in %u ms", what, bytes / 1024, us / 1000);
+    if (us) kprintf(", %u KiB/s", (uint32_t)udiv64((uint64_t)(bytes / 1024) * 1000000, us));
+    kprint("\n");
+}
+
+/* On a disk, how many journal commits the run took */
+static void bench_report_journal(uint32_t commits_before) {
+    uint32_t commits = journal_get_stats()->commits - commits_before;
+    if (commits == 0) return;
+    kprintf("  journal commits: %u\n", commits);
+}
+
+static void bench_name(uint32_t i, char *name) {
+    name[0] = 'f';
+    int_to_ascii(i, name + 1);
+}
+
+/* Create, look up and delete 'n' empty files in a scratch directory */
+static void bench_files(uint32_t n, int32_t dir) {
+    int32_t scratch = fs_create("bench", dir, 1);
+    if (scratch == -1) {
+        kprint("bench: cannot create directory 'bench'.\n");
+        return;
+    }
+
+    char name[16];
+    uint32_t made = 0;
+    uint32_t commits = journal_get_stats()->commits;
+    uint64_t start = rdtsc();
+    while (made < n) {
+        bench_name(made, name);
+        if (fs_create(name, scratch, 0) == -1) break;
+        made++;
+    }
+    fs_sync();
+    bench_report("create", made, rdtsc() - start);
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < made; i++) {
+        bench_name(i, name);
+        fs_open(name, scratch);
+    }
+    bench_report("lookup", made, rdtsc() - start);
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < made; i++) {
+        bench_name(i, name);
+        fs_delete(name, scratch);
+    }
+    fs_sync();
+    bench_report("delete", made, rdtsc() - start);
+
+    fs_delete("bench", dir);
+    bench_report_journal(commits);
+}
+
+static uint8_t io_buffer[FS_BLOCK_SIZE];
+
+/* Append a file of 'mib' MiB one block at a time, then read it back */
+static void bench_io(uint32_t mib, int32_t dir) {
+    int32_t fd = fs_create("bench.dat", dir, 0);
+    if (fd == -1) {
+        kprint("bench: cannot create file 'bench.dat'.\n");
+        return;
+    }
+    for (uint32_t i = 0; i < sizeof(io_buffer); i++) io_buffer[i] = i;
+    uint32_t commits = journal_get_stats()->commits;
+
+    uint32_t total = mib * 1024 * 1024;
+    uint32_t written = 0;
+    uint64_t start = rdtsc();
+    while (written < total) {
+        if (fs_write_at(fd, written, io_buffer, sizeof(io_buffer)) != sizeof(io_buffer)) break;
+        written += sizeof(io_buffer);
+    }
+    fs_sync();
+    bench_report_rate("append", written, rdtsc() - start);
+    if (written < total) kprint("bench: file system full.\n");
+
+    uint32_t read = 0;
+    readahead_t ra;
+    readahead_init(&ra);
+    start = rdtsc();
+    while (read < written) {
+        int32_t n = fs_read_stream(fd, read, io_buffer, sizeof(io_buffer), &ra);
+        if (n <= 0) break;
+        read += n;
+    }
+    bench_report_rate("read", read, rdtsc() - start);
+
+    fs_delete("bench.dat", dir);
+    bench_report_journal(commits);
+}
+
+static void bench_report_lines(char *what, uint32_t lines, uint64_t cycles) {
+    uint32_t us = timer_cycles_to_us(cycles);
+    kprintf("  %s: %u lines in %u ms", what, lines, us / 1000);
+    if (us) kprintf(", %u lines/s", (uint32_t)udiv64((uint64_t)lines * 1000000, us));
+    kprint("\n");
+}
+
+/* Print 'n' numbered lines piece by piece, then with kprintf */
+static void bench_print(uint32_t n) {
+    char s[12];
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < n; i++) {
+        kprint("line ");
+        int_to_ascii(i, s);
+        kprint(s);
+        kprint(" of ");
+        int_to_ascii(n, s);
+        kprint(s);
+        kprint(", irq ");
+        hex_to_ascii(i & 0xFF, s);
+        kprint(s);
+        kprint("\n");
+    }
+    uint64_t pieces = rdtsc() - start;
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < n; i++) kprintf("line %u of %u, irq 0x%x\n", i, n, i & 0xFF);
+    uint64_t formatted = rdtsc() - start;
+
+    bench_report_lines("kprint", n, pieces);
+    bench_report_lines("kprintf", n, formatted);
+}
+
+#define BENCH_KEYS 200
+
+/* Per keystroke cost of the editor on files from 16 KiB up to 'max_kib'.
+ * Each round moves down a row, types a character and deletes it. */
+static void bench_edit(uint32_t max_kib, int32_t dir) {
+    uint32_t sizes[8];
+    uint64_t cycles[8];
+    uint32_t runs = 0;
+
+    for (uint32_t i = 0; i < sizeof(io_buffer); i++) io_buffer[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+    for (uint32_t kib = 16; kib <= max_kib && runs < 8; kib *= 4) {
+        int32_t fd = fs_create("bench.txt", dir, 0);
+        if (fd == -1) break;
+        uint32_t size = 0;
+        while (size < kib * 1024 && fs_write_at(fd, size, io_buffer, sizeof(io_buffer)) > 0) {
+            size += sizeof(io_buffer);
+        }
+
+        editor_init("bench.txt", dir);
+        if (current_kernel_mode != MODE_EDIT) {
+            fs_delete("bench.txt", dir);
+            break;
+        }
+        uint64_t start = rdtsc();
+        for (uint32_t k = 0; k < BENCH_KEYS; k++) {
+            editor_handle_key(SC_DOWN);
+            editor_handle_char('x');
+            editor_handle_char(0x08);
+        }
+        cycles[runs] = rdtsc() - start;
+        sizes[runs++] = size / 1024;
+
+        editor_trigger_exit();
+        editor_handle_input("n");
+        fs_delete("bench.txt", dir);
+    }
+
+    char what[24];
+    for (uint32_t i = 0; i < runs; i++) {
+        ksnprintf(what, sizeof(what), "%u KiB", sizes[i]);
+        bench_report(what, 3 * BENCH_KEYS, cycles[i]);
+    }
+}
+
+/* What memory_find and memory_search are measured against */
+static uint8_t *naive_search(uint8_t *hay, uint32_t n, uint8_t *needle, uint32_t m) {
+    for (uint32_t i = 0; i + m <= n; i++) {
+        uint32_t j = 0;
+        while (j < m && hay[i + j] == needle[j]) j++;
+        if (j == m) return hay + i;
+    }
+    return NULL;
+}
+
+/* Search 'kib' KiB of text for a byte and for strings of a few lengths
+ * that are only in the last few dozen bytes, one after the other, so
+ * every search scans nearly all of it */
+static void bench_search(uint32_t kib) {
+    uint32_t size = kib * 1024;
+    uint8_t *text = (uint8_t*)kmalloc(size, 0, NULL);
+    if (!text) {
+        kprint("bench: out of memory.\n");
+        return;
+    }
+    static char *words[] = { "the ", "kernel ", "maps ", "a ", "page ", "of ", "text\n" };
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < size; ) {
+        seed = seed * 1103515245 + 12345;
+        for (char *w = words[(seed >> 16) % 7]; *w && i < size; w++) text[i++] = *w;
+    }
+    // Shortest first, so none turns up inside a longer one before its
+    // own place
+    static char *needles[] = { "@", "pag!", "kernel maps text!", "the kernel maps a page of text, then!" };
+    uint8_t *places[4];
+    uint8_t *end = text + size;
+    for (int k = 3; k >= 0; k--) {
+        uint32_t m = strlen(needles[k]);
+        end -= m;
+        places[k] = end;
+        memory_copy((uint8_t*)needles[k], end, m);
+    }
+
+    char what[48];
+    for (uint32_t k = 0; k < 4; k++) {
+        uint8_t *needle = (uint8_t*)needles[k];
+        uint32_t m = strlen(needles[k]);
+        uint64_t start = rdtsc();
+        uint8_t *hit = naive_search(text, size, needle, m);
+        uint64_t naive = rdtsc() - start;
+        start = rdtsc();
+        uint8_t *fast = m == 1 ? memory_find(text, needle[0], size) : memory_search(text, size, needle, m);
+        uint64_t cycles = rdtsc() - start;
+        if (hit != places[k] || fast != places[k]) kprintf("  wrong match for '%s'\n", needles[k]);
+
+        ksnprintf(what, sizeof(what), "naive, %u bytes", m);
+        bench_report_rate(what, size, naive);
+        ksnprintf(what, sizeof(what), "%s, %u bytes", m == 1 ? "memory_find" : "memory_search", m);
+        bench_report_rate(what, size, cycles);
+    }
+    kfree((uint32_t)text);
+}
+
+/* Send 'kib' KiB of text to the serial console: what queueing costs
+ * the caller, and how fast the UART empties the ring. The transmit
+ * interrupt cannot come in here, so the ring is drained by polling. */
+static void bench_serial(uint32_t kib) {
+    if (!serial_present()) {
+        kprint("No serial port\n");
+        return;
+    }
+
+    char line[64];
+    uint32_t bytes = 0, lines = 0;
+    uint32_t dropped = serial_dropped();
+    uint64_t queued = 0;
+    serial_drain();
+
+    uint64_t start = rdtsc();
+    while (bytes < kib * 1024) {
+        int len = ksnprintf(line, sizeof(line), "serial bench line %u of %u KiB\n", lines++, kib);
+        while (serial_tx_pending() + len + 1 > SERIAL_TX_RING) serial_poll();
+        uint64_t t = rdtsc();
+        serial_write(line, len);
+        queued += rdtsc() - t;
+        bytes += len + 1; /* '\n' goes out as "\r\n" */
+    }
+    serial_drain();
+    uint64_t total = rdtsc() - start;
+
+    bench_report("queue", bytes, queued);
+    bench_report_rate("send", bytes, total);
+    kprintf("  line limit at %u baud: %u KiB/s\n", SERIAL_BAUD, SERIAL_BAUD / 10 / 1024);
+    if (serial_dropped() != dropped) kprintf("  dropped: %u bytes\n", serial_dropped() - dropped);
+}
+
+/* 'bench <what> [n]': 'n' sizes the run, each has its own default */
+static void bench_command(int argc, char **argv) {
+    char *what = argc >= 2 ? argv[1] : "";
+    uint32_t n = argc >= 3 ? atoi(argv[2]) : 0;
+    int32_t dir = shell_get_dir();
+
+    if (strcmp(what, "files") == 0) {
+        bench_files(n ? n : 50000, dir);
+    } else if (strcmp(what, "io") == 0) {
+        bench_io(n ? n : 4, dir);
+    } else if (strcmp(what, "print") == 0) {
+        bench_print(n ? n : 2000);
+    } else if (strcmp(what, "edit") == 0) {
+        bench_edit(n ? n : 4096, dir);
+    } else if (strcmp(what, "search") == 0) {
+        bench_search(n ? n : 4096);
+    } else if (strcmp(what, "serial") == 0) {
+        bench_serial(n ? n : 64);
+    } else {
+        kprint("Usage: bench files [count] | bench io [MiB] | bench print [lines] | bench edit [KiB] | bench search [KiB] | bench serial [KiB]\n");
+    }
+}
+
+void bench_init() {
+    shell_register("bench", "bench files|io|print|edit|search|serial [n]", bench_command);
+}
@@ -0,0 +1,8 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+void bench_init();
+
+#endif
@@ -1,9 +1,13 @@
 #include "editor.h"
 #include "shell.h"
 #include "input.h"
+#include "gap_buffer.h"
+#include "line_index.h"
+#include "undo.h"
 #include "../drivers/screen.h"
 #include "../drivers/keyboard.h"
 #include "../fs/fs.h"
+#include "../fs/file.h"
 #include "../libc/string.h"
 #include "../libc/mem.h"
 #include <stdint.h>
@@ -13,22 +17,55 @@ extern void shell_print_prompt();
 kernel_mode_t current_kernel_mode = MODE_SHELL;
 
 static char current_file[MAX_FILENAME];
-static char file_buffer[2048];
-static uint32_t buffer_offset = 0;
-static int16_t current_dir = -1;
+static gap_buffer_t text;
+static line_index_t lines;
+static undo_log_t history;
+static int32_t current_dir = -1;
 static int32_t current_fd = -1;
+static int32_t current_handle = -1;
 
-static int cursor_x = 0;
+// Only bytes from 'dirty_from' on differ from the file on disk
+#define CLEAN 0xFFFFFFFF
+static uint32_t dirty_from = CLEAN;
+static uint32_t saved_size = 0;
+
+static uint32_t cursor = 0; // Offset of the cursor in the text
+static int cursor_x = 0;    // Where it is on the screen
 static int cursor_y = 1;
 
+// The screen shows the text from row 'top_row' of line 'top_line':
+// a long line wraps over several rows
+static uint32_t top_line = 0;
+static uint32_t top_row = 0;
+
+// Text rows whose contents changed since they were last drawn
+static uint64_t stale_rows = 0;
+
+// Ctrl+F and Ctrl+R read what to look for on the status line
+#define PROMPT_MAX 64
+typedef enum { PROMPT_NONE, PROMPT_FIND, PROMPT_REPLACE, PROMPT_WITH } prompt_t;
+static prompt_t prompt = PROMPT_NONE;
+static char prompt_text[PROMPT_MAX + 1];
+static char replace_text[PROMPT_MAX + 1]; // What to replace, while asking with what
+static uint32_t search_start = 0;  // The cursor before the search, to go back to
+static uint32_t search_origin = 0; // Where matches are looked for from
+static int search_failed = 0;
+static char message[40] = "";      // Shown on the status line until the next key
+
 #define HEADER_ATTR 0x70 // Black on light grey
 #define STATUS_ATTR 0x70 // Black on light grey
 #define TEXT_ATTR   0x0F // White on black
 
+// The text sits between the header and the status line, which is the
+// last row of the console
+static int status_row() {
+    return screen_rows() - 1;
+}
+
 static void editor_draw_header() {
-    char header[81];
-    memory_set((uint8_t*)header, ' ', 80);
-    header[80] = '\0';
+    char header[MAX_COLS + 1];
+    memory_set((uint8_t*)header, ' ', screen_cols());
+    header[screen_cols()] = '\0';
     kprint_at_color(header, 0, 0, HEADER_ATTR);
     
     char path[256];
@@ -40,248 +77,595 @@ static void editor_draw_header() {
     strcat(title, " | Path: ");
     strcat(title, path);
     
-    if (strlen(title) > 79) title[79] = '\0';
+    if ((int)strlen(title) > screen_cols() - 1) title[screen_cols() - 1] = '\0';
     kprint_at_color(title, 0, 0, HEADER_ATTR);
 }
 
-static void editor_draw_content() {
-    // Clear text area (lines 1 to 23)
-    for (int y = 1; y < 24; y++) {
-        char blank[81];
-        memory_set((uint8_t*)blank, ' ', 80);
-        blank[80] = '\0';
-        kprint_at_color(blank, 0, y, TEXT_ATTR);
-    }
+// Rows a line takes on the screen: it wraps every screen_cols() characters
+static int line_rows(uint32_t line) {
+    return line_index_length(&lines, line) / screen_cols() + 1;
+}
+
+// Rows 'from' to 'to' of the text area have to be drawn again
+static void mark_stale(int from, int to) {
+    if (from < 1) from = 1;
+    if (to > status_row() - 1) to = status_row() - 1;
+    for (int y = from; y <= to; y++) stale_rows |= (uint64_t)1 << y;
+}
 
-    int cur_y = 1;
-    int cur_x = 0;
-    for (uint32_t i = 0; i < buffer_offset; i++) {
-        if (file_buffer[i] == '\n') {
-            cur_y++;
-            cur_x = 0;
-            if (cur_y >= 24) break;
-            continue;
+// Draw row 'row' of 'line' on screen row 'y', padded to the width so
+// the whole row is one write
+static void draw_row(int y, uint32_t line, uint32_t row) {
+    uint32_t cols = screen_cols();
+    char buf[MAX_COLS + 1];
+    uint32_t n = 0;
+    if (line < line_index_count(&lines)) {
+        uint32_t start = line_index_start(&lines, line);
+        uint32_t end = start + line_index_length(&lines, line);
+        uint32_t pos = start + row * cols;
+        while (pos < end && n < cols) {
+            uint32_t len;
+            char *span = gap_span(&text, pos, &len);
+            if (len > end - pos) len = end - pos;
+            if (len > cols - n) len = cols - n;
+            memory_copy((uint8_t*)span, (uint8_t*)buf + n, len);
+            pos += len;
+            n += len;
         }
-        
-        if (cur_x < 80) {
-            char c_str[2] = {file_buffer[i], '\0'};
-            kprint_at_color(c_str, cur_x, cur_y, TEXT_ATTR);
-            cur_x++;
-            if (cur_x >= 80) {
-                cur_x = 0;
-                cur_y++;
-                if (cur_y >= 24) break;
-            }
+    }
+    // NUL would end the string and the screen takes 0x08 as a backspace
+    for (uint32_t i = 0; i < n; i++) {
+        if (buf[i] == 0 || buf[i] == 0x08) buf[i] = ' ';
+    }
+    memory_set((uint8_t*)buf + n, ' ', cols - n);
+    buf[cols] = '\0';
+    kprint_at_color(buf, 0, y, TEXT_ATTR);
+}
+
+// Draw the stale rows. Finding what each row shows is a walk down from
+// the top of the viewport, only the stale ones are written.
+static void editor_draw_content() {
+    if (!stale_rows) return;
+    uint32_t line = top_line;
+    uint32_t row = top_row;
+    uint32_t count = line_index_count(&lines);
+    for (int y = 1; y < status_row(); y++) {
+        if (stale_rows & ((uint64_t)1 << y)) draw_row(y, line, row);
+        if (line < count && ++row == (uint32_t)line_rows(line)) {
+            line++;
+            row = 0;
         }
     }
+    stale_rows = 0;
 }
 
 static void editor_draw_footer() {
-    char footer[81];
-    memory_set((uint8_t*)footer, ' ', 80);
-    // CRITICAL: only print 79 chars on the last line to avoid triggering screen scroll
-    footer[79] = '\0'; 
-    kprint_at_color(footer, 0, 24, STATUS_ATTR);
+    char footer[MAX_COLS + 1];
+    memory_set((uint8_t*)footer, ' ', screen_cols());
+    // CRITICAL: leave the last cell alone to avoid triggering screen scroll
+    footer[screen_cols() - 1] = '\0'; 
+    kprint_at_color(footer, 0, status_row(), STATUS_ATTR);
     
     if (current_kernel_mode == MODE_SAVE_PROMPT) {
-        kprint_at_color(" Save? (y/n): ", 0, 24, 0x0E);
+        kprint_at_color(" Save? (y/n): ", 0, status_row(), 0x0E);
+    } else if (prompt != PROMPT_NONE) {
+        char line[PROMPT_MAX + 32];
+        strcpy(line, prompt == PROMPT_FIND ? " Search: " : prompt == PROMPT_REPLACE ? " Replace: " : " With: ");
+        strcat(line, prompt_text);
+        if (search_failed) strcat(line, "  [not found]");
+        if ((int)strlen(line) > screen_cols() - 1) line[screen_cols() - 1] = '\0';
+        kprint_at_color(line, 0, status_row(), STATUS_ATTR);
+    } else if (message[0]) {
+        kprint_at_color(message, 0, status_row(), STATUS_ATTR);
     } else {
-        kprint_at_color(" Ctrl+X: Exit and Save/Discard", 0, 24, STATUS_ATTR);
+        kprint_at_color(" Ctrl+X: Exit  Ctrl+F: Search  Ctrl+R: Replace  Ctrl+Z: Undo  Ctrl+Y: Redo", 0, status_row(), STATUS_ATTR);
     }
 }
 
 void editor_draw_ui() {
+    screen_begin();
     editor_draw_header();
+    mark_stale(1, status_row() - 1);
     editor_draw_content();
     editor_draw_footer();
     if (current_kernel_mode == MODE_SAVE_PROMPT) {
-        set_cursor(14, 24);
+        set_cursor(14, status_row());
     } else {
         set_cursor(cursor_x, cursor_y);
     }
+    screen_end();
 }
 
-// Maps screen coordinates to buffer index
-static uint32_t get_buffer_index(int x, int y) {
-    uint32_t index = 0;
-    int cur_x = 0;
-    int cur_y = 1;
+// Screen position of offset 'pos'. The line is found in the index;
+// only the lines between it and the top of the viewport are walked.
+// Above the viewport comes out as row 0, below it as status_row() or more.
+static void screen_position(uint32_t pos, int *x, int *y) {
+    uint32_t cols = screen_cols();
+    uint32_t line = line_index_find(&lines, pos);
+    uint32_t col = pos - line_index_start(&lines, line);
+    *x = col % cols;
+    if (line < top_line || (line == top_line && col / cols < top_row)) {
+        *y = 0;
+        return;
+    }
+    int row = 1 - (int)top_row;
+    for (uint32_t k = top_line; k < line && row < status_row(); k++) row += line_rows(k);
+    *y = row + col / cols;
+}
 
-    while (index < buffer_offset) {
-        if (cur_x == x && cur_y == y) return index;
+// Scroll so that offset 'pos' is on the screen: its row goes on top if
+// it is above the viewport, at the bottom if below
+static void scroll_to(uint32_t pos) {
+    int x, y;
+    screen_position(pos, &x, &y);
+    if (y >= 1 && y < status_row()) return;
 
-        if (file_buffer[index] == '\n') {
-            cur_y++;
-            cur_x = 0;
-        } else {
-            cur_x++;
-            if (cur_x >= 80) {
-                cur_x = 0;
-                cur_y++;
-            }
+    uint32_t line = line_index_find(&lines, pos);
+    uint32_t row = (pos - line_index_start(&lines, line)) / screen_cols();
+    if (y >= status_row()) {
+        for (int n = status_row() - 2; n > 0; n--) {
+            if (row > 0) row--;
+            else if (line > 0) row = line_rows(--line) - 1;
         }
-        index++;
     }
-    return index;
+    top_line = line;
+    top_row = row;
+    mark_stale(1, status_row() - 1);
 }
 
-// Sets cursor position based on a buffer index
-static void set_cursor_from_index(uint32_t target_index) {
-    int cur_x = 0;
-    int cur_y = 1;
-    for (uint32_t i = 0; i < target_index; i++) {
-        if (file_buffer[i] == '\n') {
-            cur_y++;
-            cur_x = 0;
-        } else {
-            cur_x++;
-            if (cur_x >= 80) {
-                cur_x = 0;
-                cur_y++;
-            }
-        }
-    }
-    cursor_x = cur_x;
-    cursor_y = cur_y;
+static void move_cursor(uint32_t pos) {
+    cursor = pos;
+    scroll_to(pos);
+    screen_position(pos, &cursor_x, &cursor_y);
 }
 
-// Returns the length (x position of end of text) of a given screen row
-static int get_row_len(int y) {
-    int cur_x = 0;
-    int cur_y = 1;
-    if (y == 1 && buffer_offset == 0) return 0;
+// Offset one screen row above or below 'pos', in the same column
+// if that row is long enough. The same offset at the first or last row.
+static uint32_t vertical_target(uint32_t pos, int down) {
+    uint32_t cols = screen_cols();
+    uint32_t line = line_index_find(&lines, pos);
+    uint32_t start = line_index_start(&lines, line);
+    uint32_t len = line_index_length(&lines, line);
+    uint32_t col = pos - start;
+    uint32_t x = col % cols;
 
-    for (uint32_t i = 0; i < buffer_offset; i++) {
-        if (file_buffer[i] == '\n') {
-            if (cur_y == y) return cur_x;
-            cur_y++;
-            cur_x = 0;
-        } else {
-            cur_x++;
-            if (cur_x >= 80) {
-                if (cur_y == y) return 80;
-                cur_y++;
-                cur_x = 0;
-            }
-        }
+    if (!down) {
+        if (col >= cols) return pos - cols;
+        if (line == 0) return pos;
+        start = line_index_start(&lines, line - 1);
+        len = line_index_length(&lines, line - 1);
+        uint32_t row_start = start + len / cols * cols;
+        return row_start + x < start + len ? row_start + x : start + len;
     }
-    if (cur_y == y) return cur_x;
-    return -1; // Row beyond text
+
+    if (col / cols < len / cols) return pos + cols < start + len ? pos + cols : start + len;
+    if (line + 1 >= line_index_count(&lines)) return pos;
+    start = line_index_start(&lines, line + 1);
+    len = line_index_length(&lines, line + 1);
+    return start + (x < len ? x : len);
 }
 
-void editor_init(char *filename, int16_t dir_idx) {
+void editor_init(char *filename, int32_t dir_idx) {
+    int32_t handle = file_open(filename, dir_idx, O_READ | O_WRITE | O_CREATE);
+    if (handle == -1) {
+        kprint("Cannot open file.\n");
+        return;
+    }
+    uint32_t size = file_lseek(handle, 0, SEEK_END);
+    if (gap_init(&text, size) != 0) {
+        kprint("File too large for the editor.\n");
+        file_close(handle);
+        return;
+    }
+    int32_t n = file_pread(handle, (uint8_t*)text.data, size, 0);
+    text.gap_start = n > 0 ? n : 0;
+    if (line_index_build(&lines, &text) != 0) {
+        kprint("File too large for the editor.\n");
+        gap_free(&text);
+        file_close(handle);
+        return;
+    }
+
     strcpy(current_file, filename);
     current_dir = dir_idx;
     current_kernel_mode = MODE_EDIT;
-    buffer_offset = 0;
+    cursor = 0;
     cursor_x = 0;
     cursor_y = 1;
+    top_line = 0;
+    top_row = 0;
+    prompt = PROMPT_NONE;
+    message[0] = '\0';
+    undo_init(&history);
 
+    current_handle = handle;
     current_fd = fs_open(current_file, current_dir);
-    if (current_fd != -1) {
-        buffer_offset = fs_read(current_fd, (uint8_t*)file_buffer, 2048);
-        if (buffer_offset > 2047) buffer_offset = 2047;
-        file_buffer[buffer_offset] = '\0';
-    } else {
-        current_fd = fs_create(current_file, current_dir, 0);
-    }
+    saved_size = text.gap_start;
+    dirty_from = CLEAN;
     
     clear_screen();
     editor_draw_ui();
 }
 
+static void editor_mark_dirty(uint32_t index) {
+    if (index < dirty_from) dirty_from = index;
+}
+
+// Write back only what changed: an edit shifts everything after it,
+// so that is the range from the first change to the end
+static void editor_save() {
+    uint32_t len = gap_length(&text);
+    uint32_t pos = dirty_from;
+    // The text is in two pieces, on either side of the gap
+    while (pos < len) {
+        uint32_t n;
+        char *span = gap_span(&text, pos, &n);
+        file_pwrite(current_handle, (uint8_t*)span, n, pos);
+        pos += n;
+    }
+    if (len < saved_size) file_truncate(current_handle, len);
+    saved_size = len;
+    dirty_from = CLEAN;
+}
+
+static void editor_close() {
+    file_close(current_handle);
+    current_handle = -1;
+    gap_free(&text);
+    line_index_free(&lines);
+    undo_free(&history);
+    current_kernel_mode = MODE_SHELL;
+    clear_screen();
+    shell_print_prompt();
+}
+
+// Offset of the first 'needle' at or after 'from', wrapping around to
+// the top of the text; -1 if there is none
+static int32_t find_next(char *needle, uint32_t from) {
+    uint32_t m = strlen(needle);
+    uint32_t len = gap_length(&text);
+    uint8_t *data = (uint8_t*)gap_text(&text);
+    if (from > len) from = len;
+
+    uint8_t *hit = memory_search(data + from, len - from, (uint8_t*)needle, m);
+    if (!hit) hit = memory_search(data, from + m - 1 < len ? from + m - 1 : len, (uint8_t*)needle, m);
+    return hit ? hit - data : -1;
+}
+
+/**
+ * Replace every 'from' with 'to'. The new text is built in one pass
+ * into a fresh buffer, so it takes the same time however many matches
+ * there are. Returns how many were replaced, -1 when out of memory.
+ */
+static int32_t replace_all(char *from, char *to) {
+    uint32_t m = strlen(from);
+    uint32_t r = strlen(to);
+    uint32_t len = gap_length(&text);
+    uint8_t *data = (uint8_t*)gap_text(&text);
+
+    uint32_t count = 0;
+    uint32_t first = 0;
+    for (uint8_t *p = data; (p = memory_search(p, data + len - p, (uint8_t*)from, m)); p += m) {
+        if (count++ == 0) first = p - data;
+    }
+    if (count == 0) return 0;
+
+    gap_buffer_t out;
+    if (gap_init(&out, len - count * m + count * r) != 0) return -1;
+
+    // The cursor moves with the text before it, to the start of the
+    // replacement if it was inside a match
+    uint8_t *src = data;
+    uint8_t *dst = (uint8_t*)out.data;
+    uint32_t moved = CLEAN;
+    uint8_t *p;
+    while ((p = memory_search(src, data + len - src, (uint8_t*)from, m))) {
+        uint32_t shift = (dst - (uint8_t*)out.data) - (src - data);
+        if (moved == CLEAN && data + cursor < p + m) moved = (data + cursor < p ? cursor : (uint32_t)(p - data)) + shift;
+        memory_copy(src, dst, p - src);
+        dst += p - src;
+        memory_copy((uint8_t*)to, dst, r);
+        dst += r;
+        src = p + m;
+    }
+    if (moved == CLEAN) moved = cursor + (dst - (uint8_t*)out.data) - (src - data);
+    memory_copy(src, dst, data + len - src);
+
+    // The index keeps a pointer to the text, so it is built in place
+    gap_buffer_t old = text;
+    line_index_t index;
+    text = out;
+    if (line_index_build(&index, &text) != 0) {
+        gap_free(&text);
+        text = old;
+        return -1;
+    }
+
+    // Logged as a delete and an insert per match, undone in one step.
+    // Each goes where the matches before it have moved it to.
+    uint32_t delta = 0;
+    int joined = 0;
+    for (p = data; (p = memory_search(p, data + len - p, (uint8_t*)from, m)); p += m) {
+        uint32_t pos = (p - data) + delta;
+        if (undo_add(&history, UNDO_DELETE, pos, from, m, joined) != 0) break;
+        if (r && undo_add(&history, UNDO_INSERT, pos, to, r, 1) != 0) break;
+        joined = 1;
+        delta += r - m;
+    }
+
+    gap_free(&old);
+    line_index_free(&lines);
+    lines = index;
+    editor_mark_dirty(first);
+
+    // Neither string holds a newline, so the lines stay where they are
+    // but may be shorter now
+    top_row = 0;
+    mark_stale(1, status_row() - 1);
+    move_cursor(moved);
+    return count;
+}
+
+static void prompt_open(prompt_t which) {
+    prompt = which;
+    prompt_text[0] = '\0';
+    search_failed = 0;
+    editor_draw_footer();
+}
+
+static void prompt_close() {
+    prompt = PROMPT_NONE;
+    search_failed = 0;
+    editor_draw_footer();
+}
+
+// Incremental search: look again from the origin as the text changes
+static void search_update() {
+    int32_t at = prompt_text[0] ? find_next(prompt_text, search_origin) : (int32_t)search_start;
+    search_failed = at == -1;
+    if (at != -1) move_cursor(at);
+}
+
+static void prompt_handle_char(char c) {
+    uint32_t n = strlen(prompt_text);
+    if (c == '\n') {
+        if (prompt == PROMPT_REPLACE && n > 0) {
+            strcpy(replace_text, prompt_text);
+            prompt_open(PROMPT_WITH);
+            return;
+        }
+        if (prompt == PROMPT_WITH) {
+            int32_t count = replace_all(replace_text, prompt_text);
+            if (count == -1) strcpy(message, " Out of memory");
+            else {
+                strcpy(message, " Replaced ");
+                int_to_ascii(count, message + strlen(message));
+            }
+        }
+        prompt_close();
+        return;
+    }
+
+    if (c == 0x08) {
+        if (n == 0) return;
+        prompt_text[n - 1] = '\0';
+    } else if (n < PROMPT_MAX) {
+        prompt_text[n] = c;
+        prompt_text[n + 1] = '\0';
+    }
+    if (prompt == PROMPT_FIND) search_update();
+    editor_draw_footer();
+}
+
+void editor_trigger_search() {
+    if (current_kernel_mode != MODE_EDIT) return;
+    if (prompt == PROMPT_FIND) {
+        // Again: on to the next match
+        if (prompt_text[0]) {
+            search_origin = cursor + 1;
+            search_update();
+        }
+    } else {
+        if (prompt != PROMPT_NONE) prompt_close();
+        undo_seal(&history);
+        search_start = search_origin = cursor;
+        prompt_open(PROMPT_FIND);
+    }
+    editor_draw_content();
+    editor_draw_footer();
+    set_cursor(cursor_x, cursor_y);
+}
+
+void editor_trigger_replace() {
+    if (current_kernel_mode != MODE_EDIT) return;
+    prompt_open(PROMPT_REPLACE);
+    set_cursor(cursor_x, cursor_y);
+}
+
 void editor_trigger_exit() {
+    // While searching, Ctrl+X gives up and goes back
+    if (current_kernel_mode == MODE_EDIT && prompt != PROMPT_NONE) {
+        if (prompt == PROMPT_FIND) move_cursor(search_start);
+        prompt_close();
+        editor_draw_content();
+        set_cursor(cursor_x, cursor_y);
+        return;
+    }
     if (current_kernel_mode == MODE_EDIT) {
         current_kernel_mode = MODE_SAVE_PROMPT;
         input_clear_buffer();
         editor_draw_footer();
-        set_cursor(14, 24);
+        set_cursor(14, status_row());
     }
 }
 
+// The message on the status line lasts until the next key
+static void clear_message() {
+    if (!message[0]) return;
+    message[0] = '\0';
+    editor_draw_footer();
+}
+
 void editor_handle_char(char c) {
     if (current_kernel_mode != MODE_EDIT) return;
+    clear_message();
+    if (prompt != PROMPT_NONE) {
+        prompt_handle_char(c);
+        editor_draw_content();
+        set_cursor(cursor_x, cursor_y);
+        return;
+    }
 
-    uint32_t index = get_buffer_index(cursor_x, cursor_y);
+    // Backspace edits the character before the cursor, which must be on
+    // the screen: the viewport would lose its line if it was joined
+    uint32_t pos = cursor;
+    if (c == 0x08) {
+        if (cursor == 0) return;
+        pos = cursor - 1;
+        scroll_to(pos);
+    }
 
-    if (c == 0x08) { // Backspace
-        if (index > 0) {
-            for (uint32_t i = index - 1; i < buffer_offset; i++) {
-                file_buffer[i] = file_buffer[i+1];
-            }
-            buffer_offset--;
-            set_cursor_from_index(index - 1);
-        }
+    // The edit shifts the rest of its line. If the line splits, joins,
+    // or changes height, every row below moves as well.
+    uint32_t line = line_index_find(&lines, pos);
+    uint32_t col = pos - line_index_start(&lines, line);
+    int rows = line_rows(line);
+    int x, y;
+    screen_position(pos, &x, &y);
+    int last = y + rows - 1 - col / screen_cols();
+    int split;
+
+    // The index is updated first, it needs the text as it was
+    if (c == 0x08) {
+        split = gap_at(&text, pos) == '\n';
+        undo_delete(&history, pos, gap_at(&text, pos));
+        line_index_delete(&lines, pos);
+        gap_delete(&text, pos);
+        cursor = pos;
     } else {
-        if (buffer_offset < 2047) {
-            for (uint32_t i = buffer_offset; i > index; i--) {
-                file_buffer[i] = file_buffer[i-1];
-            }
-            file_buffer[index] = c;
-            buffer_offset++;
-            file_buffer[buffer_offset] = '\0';
-            set_cursor_from_index(index + 1);
+        if (gap_reserve(&text, 1) != 0 || line_index_insert(&lines, pos, c) != 0) return;
+        split = c == '\n';
+        gap_insert(&text, pos, c);
+        cursor = pos + 1;
+        // A typed run is undone a line at a time
+        undo_insert(&history, pos, c);
+        if (split) undo_seal(&history);
+    }
+    editor_mark_dirty(pos);
+
+    if (split || line_rows(line) != rows) last = status_row() - 1;
+    mark_stale(y, last);
+    move_cursor(cursor);
+    editor_draw_content();
+    set_cursor(cursor_x, cursor_y);
+}
+
+// Insert the bytes of 'r' at its position, or delete them, and put the
+// cursor after the change
+static int apply(undo_record_t *r, int insert) {
+    editor_mark_dirty(r->pos);
+    if (!insert) {
+        for (uint32_t i = 0; i < r->len; i++) {
+            line_index_delete(&lines, r->pos);
+            gap_delete(&text, r->pos);
         }
+        cursor = r->pos;
+        return 0;
     }
-    
-    if (cursor_y > 23) cursor_y = 23;
-    if (cursor_y < 1) cursor_y = 1;
 
+    if (gap_reserve(&text, r->len) != 0) return -1;
+    for (uint32_t i = 0; i < r->len; i++) {
+        char c = undo_byte(&history, r, i);
+        if (line_index_insert(&lines, r->pos + i, c) != 0) return -1;
+        gap_insert(&text, r->pos + i, c);
+        cursor = r->pos + i + 1;
+    }
+    return 0;
+}
+
+// After undo or redo, which may change lines anywhere: keep the
+// viewport on a row that exists and bring the cursor into it
+static void after_history(int failed) {
+    if (failed) {
+        // Part of a step is applied: what is left of the log no longer fits
+        undo_clear(&history);
+        strcpy(message, " Out of memory, undo history lost");
+    }
+    uint32_t count = line_index_count(&lines);
+    if (top_line >= count) top_line = count - 1;
+    if (top_row >= (uint32_t)line_rows(top_line)) top_row = 0;
+    mark_stale(1, status_row() - 1);
+    move_cursor(cursor);
     editor_draw_content();
+    editor_draw_footer();
     set_cursor(cursor_x, cursor_y);
 }
 
+// Ctrl+Z: revert the last step, a typed run or a whole replace
+void editor_trigger_undo() {
+    if (current_kernel_mode != MODE_EDIT) return;
+    if (prompt != PROMPT_NONE) prompt_close();
+
+    undo_record_t *r;
+    int failed = 0;
+    while ((r = undo_back(&history))) {
+        if ((failed = apply(r, r->kind == UNDO_DELETE)) != 0) break;
+        if (!(r->flags & UNDO_JOINED)) break;
+    }
+    after_history(failed);
+}
+
+// Ctrl+Y: apply again what was undone last
+void editor_trigger_redo() {
+    if (current_kernel_mode != MODE_EDIT) return;
+    if (prompt != PROMPT_NONE) prompt_close();
+
+    undo_record_t *r;
+    int failed = 0;
+    while ((r = undo_forward(&history))) {
+        if ((failed = apply(r, r->kind == UNDO_INSERT)) != 0) break;
+        if (history.done == history.count || !(history.records[history.done].flags & UNDO_JOINED)) break;
+    }
+    after_history(failed);
+}
+
 void editor_handle_key(uint8_t scancode) {
     if (current_kernel_mode != MODE_EDIT) return;
+    clear_message();
+    // Moving ends a search where it is, and the run being typed
+    if (prompt != PROMPT_NONE) prompt_close();
+    undo_seal(&history);
 
-    int len;
-    if (scancode == 0x48) { // UP
-        if (cursor_y > 1) {
-            cursor_y--;
-            len = get_row_len(cursor_y);
-            if (cursor_x > len) cursor_x = len;
-        }
-    } else if (scancode == 0x50) { // DOWN
-        len = get_row_len(cursor_y + 1);
-        if (len != -1) {
-            cursor_y++;
-            if (cursor_x > len) cursor_x = len;
-        }
-    } else if (scancode == 0x4B) { // LEFT
-        if (cursor_x > 0) {
-            cursor_x--;
-        } else if (cursor_y > 1) {
-            cursor_y--;
-            cursor_x = get_row_len(cursor_y);
-        }
-    } else if (scancode == 0x4D) { // RIGHT
-        len = get_row_len(cursor_y);
-        if (cursor_x < len) {
-            cursor_x++;
-        } else if (get_row_len(cursor_y + 1) != -1) {
-            cursor_y++;
-            cursor_x = 0;
-        }
+    if (scancode == SC_UP) {
+        move_cursor(vertical_target(cursor, 0));
+    } else if (scancode == SC_DOWN) {
+        move_cursor(vertical_target(cursor, 1));
+    } else if (scancode == SC_LEFT) {
+        if (cursor > 0) move_cursor(cursor - 1);
+    } else if (scancode == SC_RIGHT) {
+        if (cursor < gap_length(&text)) move_cursor(cursor + 1);
+    } else if (scancode == SC_PGUP || scancode == SC_PGDN) {
+        // A screenful, less a row that stays in view
+        uint32_t pos = cursor;
+        for (int n = 2; n < status_row(); n++) pos = vertical_target(pos, scancode == SC_PGDN);
+        move_cursor(pos);
     }
 
+    editor_draw_content();
     set_cursor(cursor_x, cursor_y);
 }
 
 void editor_handle_input(char *input) {
     if (current_kernel_mode == MODE_SAVE_PROMPT) {
         if (input[0] == 'y' || input[0] == 'Y') {
-            fs_write(current_fd, (uint8_t*)file_buffer, buffer_offset);
-            current_kernel_mode = MODE_SHELL;
-            clear_screen();
-            shell_print_prompt();
+            editor_save();
+            editor_close();
         } else if (input[0] == 'n' || input[0] == 'N') {
-            current_kernel_mode = MODE_SHELL;
-            clear_screen();
-            shell_print_prompt();
+            editor_close();
         } else {
             input_clear_buffer();
             editor_draw_footer();
-            set_cursor(14, 24);
+            set_cursor(14, status_row());
         }
     }
 }
@@ -6,16 +6,21 @@
 typedef enum { 
     MODE_SHELL, 
     MODE_EDIT, 
-    MODE_SAVE_PROMPT 
+    MODE_SAVE_PROMPT,
+    MODE_PAGER
 } kernel_mode_t;
 
 extern kernel_mode_t current_kernel_mode;
 
-void editor_init(char *filename, int16_t dir_idx);
+void editor_init(char *filename, int32_t dir_idx);
 void editor_handle_input(char *input);
 void editor_handle_char(char c);
 void editor_handle_key(uint8_t scancode);
 void editor_trigger_exit();
+void editor_trigger_search();
+void editor_trigger_replace();
+void editor_trigger_undo();
+void editor_trigger_redo();
 void editor_draw_ui();
 
 #endif
@@ -0,0 +1,141 @@
+#include "filters.h"
+#include "shell.h"
+#include "../drivers/screen.h"
+#include "../libc/string.h"
+#include "../libc/mem.h"
+#include "../libc/printf.h"
+#include "../libc/function.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Commands that read what comes before them in a pipeline. They get
+ * their input a chunk at a time, straight from the pipe, and keep what
+ * they need between chunks in the state the shell gives each use of
+ * them, so one can appear twice in a pipeline. */
+
+typedef struct {
+    uint32_t lines, words, bytes;
+    uint8_t in_word;
+} wc_state_t;
+
+static int wc_start(void *state, int argc, char **argv) {
+    wc_state_t *wc = state;
+    wc->lines = wc->words = wc->bytes = 0;
+    wc->in_word = 0;
+    UNUSED(argc);
+    UNUSED(argv);
+    return 0;
+}
+
+static void wc_data(void *state, char *data, uint32_t len) {
+    wc_state_t *wc = state;
+    wc->bytes += len;
+    for (uint32_t i = 0; i < len; i++) {
+        char c = data[i];
+        uint8_t space = c == ' ' || c == '\n' || c == '\t' || c == '\r';
+        if (c == '\n') wc->lines++;
+        if (!space && !wc->in_word) wc->words++;
+        wc->in_word = !space;
+    }
+}
+
+static void wc_end(void *state) {
+    wc_state_t *wc = state;
+    kprintf("%u %u %u\n", wc->lines, wc->words, wc->bytes);
+}
+
+static shell_filter_t wc_filter = { sizeof(wc_state_t), wc_start, wc_data, wc_end };
+
+/* Lines are matched where they lie in the chunk. Only one cut by the
+ * end of a chunk is copied, to join it with the rest. */
+typedef struct {
+    char *pattern;
+    uint32_t length;
+    uint32_t carry; // Bytes of an unfinished line in 'line'
+    char line[GREP_LINE];
+} grep_state_t;
+
+static int grep_start(void *state, int argc, char **argv) {
+    grep_state_t *grep = state;
+    if (argc != 2) {
+        kprint("Usage: grep <text>\n");
+        return -1;
+    }
+    grep->pattern = argv[1];
+    grep->length = strlen(argv[1]);
+    grep->carry = 0;
+    return 0;
+}
+
+static void grep_match(grep_state_t *grep, char *line, uint32_t len) {
+    if (!memory_search((uint8_t*)line, len, (uint8_t*)grep->pattern, grep->length)) return;
+    kprint_len(line, len);
+    if (line[len - 1] != '\n') kprint("\n");
+}
+
+static void grep_data(void *state, char *data, uint32_t len) {
+    grep_state_t *grep = state;
+    while (len) {
+        uint8_t *nl = memory_find((uint8_t*)data, '\n', len);
+        uint32_t n = nl ? (uint32_t)((char*)nl - data) + 1 : len;
+        if (grep->carry || !nl) {
+            // Whatever does not fit in the buffer is not matched
+            uint32_t room = GREP_LINE - grep->carry;
+            memory_copy((uint8_t*)data, (uint8_t*)grep->line + grep->carry, n < room ? n : room);
+            grep->carry += n < room ? n : room;
+            if (nl) {
+                grep_match(grep, grep->line, grep->carry);
+                grep->carry = 0;
+            }
+        } else {
+            grep_match(grep, data, n);
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static void grep_end(void *state) {
+    grep_state_t *grep = state;
+    if (grep->carry) grep_match(grep, grep->line, grep->carry);
+    grep->carry = 0;
+}
+
+static shell_filter_t grep_filter = { sizeof(grep_state_t), grep_start, grep_data, grep_end };
+
+typedef struct {
+    uint32_t left; // Lines still to print
+} head_state_t;
+
+static int head_start(void *state, int argc, char **argv) {
+    head_state_t *head = state;
+    head->left = argc >= 2 ? (uint32_t)atoi(argv[1]) : HEAD_LINES;
+    return 0;
+}
+
+static void head_data(void *state, char *data, uint32_t len) {
+    head_state_t *head = state;
+    uint32_t n = 0;
+    while (head->left && n < len) {
+        uint8_t *nl = memory_find((uint8_t*)data + n, '\n', len - n);
+        if (!nl) {
+            n = len;
+            break;
+        }
+        n = (uint32_t)((char*)nl - data) + 1;
+        head->left--;
+    }
+    if (n) kprint_len(data, n);
+}
+
+static void head_end(void *state) {
+    UNUSED(state);
+}
+
+static shell_filter_t head_filter = { sizeof(head_state_t), head_start, head_data, head_end };
+
+void filters_init() {
+    shell_register_filter("wc", "wc", &wc_filter);
+    shell_register_filter("grep", "grep <text>", &grep_filter);
+    shell_register_filter("head", "head [lines]", &head_filter);
+}
@@ -0,0 +1,11 @@
+#ifndef FILTERS_H
+#define FILTERS_H
+
+#include <stdint.h>
+
+#define GREP_LINE 1024 /* Longest line grep matches whole across two chunks */
+#define HEAD_LINES 10
+
+void filters_init();
+
+#endif
@@ -0,0 +1,106 @@
+#include "gap_buffer.h"
+#include "../libc/mem.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* The gap follows the cursor. Typing fills it from the front and
+ * backspace widens it, both O(1); moving it costs the distance moved.
+ * When it is used up the buffer doubles, so inserts stay amortized
+ * O(1) whatever the size of the text. */
+
+/**
+ * Make room for 'length' bytes of text, followed by the gap. The
+ * caller fills the first 'length' bytes of 'data'.
+ * Returns -1 when out of memory.
+ */
+int gap_init(gap_buffer_t *g, uint32_t length) {
+    g->size = length + GAP_MIN;
+    g->data = (char*)kmalloc(g->size, 0, NULL);
+    g->gap_start = length;
+    g->gap_end = g->size;
+    return g->data ? 0 : -1;
+}
+
+void gap_free(gap_buffer_t *g) {
+    kfree((uint32_t)g->data);
+    g->data = NULL;
+    g->size = g->gap_start = g->gap_end = 0;
+}
+
+uint32_t gap_length(gap_buffer_t *g) {
+    return g->size - (g->gap_end - g->gap_start);
+}
+
+char gap_at(gap_buffer_t *g, uint32_t pos) {
+    if (pos >= g->gap_start) pos += g->gap_end - g->gap_start;
+    return g->data[pos];
+}
+
+/* Bytes stored contiguously from 'pos': where they are and how many */
+char *gap_span(gap_buffer_t *g, uint32_t pos, uint32_t *len) {
+    if (pos < g->gap_start) {
+        *len = g->gap_start - pos;
+        return &g->data[pos];
+    }
+    *len = g->size - (pos + g->gap_end - g->gap_start);
+    return &g->data[pos + g->gap_end - g->gap_start];
+}
+
+/* Put the gap at 'pos' */
+static void gap_move(gap_buffer_t *g, uint32_t pos) {
+    if (pos < g->gap_start) {
+        uint32_t n = g->gap_start - pos;
+        /* Moving right within the buffer: copy backwards */
+        for (uint32_t i = 1; i <= n; i++) g->data[g->gap_end - i] = g->data[g->gap_start - i];
+        g->gap_start -= n;
+        g->gap_end -= n;
+    } else if (pos > g->gap_start) {
+        uint32_t n = pos - g->gap_start;
+        memory_copy((uint8_t*)&g->data[g->gap_end], (uint8_t*)&g->data[g->gap_start], n);
+        g->gap_start += n;
+        g->gap_end += n;
+    }
+}
+
+/* The whole text in one piece, for searching: the gap moves to the
+ * end, which costs nothing again until the next edit */
+char *gap_text(gap_buffer_t *g) {
+    gap_move(g, gap_length(g));
+    return g->data;
+}
+
+/* Double the buffer, keeping the text after the gap at the end */
+static int gap_grow(gap_buffer_t *g) {
+    uint32_t size = g->size * 2;
+    char *data = (char*)krealloc((uint32_t)g->data, size);
+    if (!data) return -1;
+
+    uint32_t tail = g->size - g->gap_end;
+    for (uint32_t i = 1; i <= tail; i++) data[size - i] = data[g->size - i];
+    g->data = data;
+    g->gap_end = size - tail;
+    g->size = size;
+    return 0;
+}
+
+/* Make sure the next 'n' inserts cannot fail */
+int gap_reserve(gap_buffer_t *g, uint32_t n) {
+    while (g->gap_end - g->gap_start < n) {
+        if (gap_grow(g) != 0) return -1;
+    }
+    return 0;
+}
+
+int gap_insert(gap_buffer_t *g, uint32_t pos, char c) {
+    if (gap_reserve(g, 1) != 0) return -1;
+    gap_move(g, pos);
+    g->data[g->gap_start++] = c;
+    return 0;
+}
+
+/* Remove the byte at 'pos' */
+void gap_delete(gap_buffer_t *g, uint32_t pos) {
+    if (pos >= gap_length(g)) return;
+    gap_move(g, pos);
+    g->gap_end++;
+}
@@ -0,0 +1,27 @@
+#ifndef GAP_BUFFER_H
+#define GAP_BUFFER_H
+
+#include <stdint.h>
+
+#define GAP_MIN 4096 /* Free space left after loading or growing */
+
+/* Text with a hole at the editing position: the bytes before it sit at
+ * the start of 'data', the ones after it at the end */
+typedef struct {
+    char *data;
+    uint32_t size;      /* Bytes allocated */
+    uint32_t gap_start; /* Logical position of the gap */
+    uint32_t gap_end;   /* First byte after it */
+} gap_buffer_t;
+
+int gap_init(gap_buffer_t *g, uint32_t length);
+void gap_free(gap_buffer_t *g);
+uint32_t gap_length(gap_buffer_t *g);
+char gap_at(gap_buffer_t *g, uint32_t pos);
+char *gap_span(gap_buffer_t *g, uint32_t pos, uint32_t *len);
+char *gap_text(gap_buffer_t *g);
+int gap_reserve(gap_buffer_t *g, uint32_t n);
+int gap_insert(gap_buffer_t *g, uint32_t pos, char c);
+void gap_delete(gap_buffer_t *g, uint32_t pos);
+
+#endif
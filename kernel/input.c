@@ -2,6 +2,7 @@
 #include "kernel.h"
 #include "shell.h"
 #include "editor.h"
+#include "pager.h"
 #include "../drivers/screen.h"
 #include "../libc/string.h"
 #include <stdbool.h>
@@ -15,12 +16,6 @@
 #define LCTRL 0x1D
 #define LCTRL_REL 0x9D
 
-#define SC_UP 0x48
-#define SC_DOWN 0x50
-#define SC_LEFT 0x4B
-#define SC_RIGHT 0x4D
-#define SC_X 0x2D
-
 #define SC_MAX 57
 static const char sc_ascii[] = { '?', '?', '1', '2', '3', '4', '5', '6',     
     '7', '8', '9', '0', '-', '=', '?', '?', 'q', 'w', 'e', 'r', 't', 'y', 
@@ -79,22 +74,72 @@ void input_handle_scancode(uint8_t scancode) {
         return;
     }
 
-    // Handle CTRL shortcuts
-    if (ctrl_pressed && scancode == SC_X) {
-        editor_trigger_exit();
+    // Ctrl+letter is the control character a terminal would send
+    if (ctrl_pressed && scancode <= SC_MAX) {
+        char letter = sc_ascii[(int)scancode];
+        if (letter >= 'a' && letter <= 'z') input_handle_char(letter & 0x1F);
         return;
     }
 
-    // Handle special keys (Arrows)
-    if (scancode == SC_UP || scancode == SC_DOWN || scancode == SC_LEFT || scancode == SC_RIGHT) {
+    // Shift+PgUp/PgDn page through the shell's scrollback
+    if (shift_pressed && (scancode == SC_PGUP || scancode == SC_PGDN)) {
+        if (current_kernel_mode == MODE_SHELL) {
+            screen_scroll_view(scancode == SC_PGUP ? screen_rows() / 2 : -screen_rows() / 2);
+        }
+        return;
+    }
+
+    // Handle special keys (Arrows, and PgUp/PgDn in the editor)
+    if (scancode == SC_UP || scancode == SC_DOWN || scancode == SC_LEFT || scancode == SC_RIGHT ||
+        scancode == SC_PGUP || scancode == SC_PGDN) {
         user_key_press(scancode);
         return;
     }
 
     if (scancode > SC_MAX) return;
 
+    char ascii = shift_pressed ? sc_ascii_shift[(int)scancode] : sc_ascii[(int)scancode];
+    if (scancode == BACKSPACE) ascii = 0x08;
+    else if (scancode == ENTER) ascii = '\n';
+    else if (ascii == '?') return;
+    input_handle_char(ascii);
+}
+
+/**
+ * The line discipline shared by the keyboard and the serial console:
+ * printable characters, backspace (0x08), newline, and Ctrl+X (0x18).
+ */
+void input_handle_char(char c) {
+    // The pager takes every key as a command
+    if (current_kernel_mode == MODE_PAGER) {
+        pager_handle_char(c);
+        return;
+    }
+
+    // Editor shortcuts: Ctrl+X, F, R, Z and Y
+    if (c == 0x18) {
+        editor_trigger_exit();
+        return;
+    }
+    if (c == 0x06) {
+        editor_trigger_search();
+        return;
+    }
+    if (c == 0x12) {
+        editor_trigger_replace();
+        return;
+    }
+    if (c == 0x1A) {
+        editor_trigger_undo();
+        return;
+    }
+    if (c == 0x19) {
+        editor_trigger_redo();
+        return;
+    }
+
     // Handle Backspace
-    if (scancode == BACKSPACE) {
+    if (c == 0x08) {
         if (current_kernel_mode == MODE_EDIT) {
             editor_handle_char(0x08);
         } else if (strlen(line_buffer) > 0) {
@@ -105,7 +150,7 @@ void input_handle_scancode(uint8_t scancode) {
     }
 
     // Handle Enter
-    if (scancode == ENTER) {
+    if (c == '\n') {
         if (current_kernel_mode == MODE_EDIT) {
             editor_handle_char('\n');
         } else {
@@ -118,15 +163,12 @@ void input_handle_scancode(uint8_t scancode) {
         return;
     }
 
-    // Handle ASCII characters
-    char ascii = shift_pressed ? sc_ascii_shift[(int)scancode] : sc_ascii[(int)scancode];
-    if (ascii != '?') {
-        if (current_kernel_mode == MODE_EDIT) {
-            editor_handle_char(ascii);
-        } else {
-            char str[2] = {ascii, '\0'};
-            append(line_buffer, ascii);
-            kprint(str);
-        }
+    if ((uint8_t)c < ' ' || (uint8_t)c > '~') return;
+    if (current_kernel_mode == MODE_EDIT) {
+        editor_handle_char(c);
+    } else if (strlen(line_buffer) < sizeof(line_buffer) - 1) {
+        char str[2] = {c, '\0'};
+        append(line_buffer, c);
+        kprint(str);
     }
 }
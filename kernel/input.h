@@ -3,8 +3,17 @@
 
 #include <stdint.h>
 
+/* Scancodes of the keys that are not characters */
+#define SC_UP 0x48
+#define SC_DOWN 0x50
+#define SC_LEFT 0x4B
+#define SC_RIGHT 0x4D
+#define SC_PGUP 0x49
+#define SC_PGDN 0x51
+
 void input_init();
 void input_handle_scancode(uint8_t scancode);
+void input_handle_char(char c);
 
 // For shell/editor to interact with the input system
 void input_clear_buffer();
@@ -3,43 +3,74 @@
 #include "../cpu/tss.h"
 #include "../cpu/paging.h"
 #include "../cpu/syscall.h"
+#include "../cpu/timer.h"
 #include "../fs/fs.h"
+#include "../fs/mmap.h"
 #include "../drivers/screen.h"
 #include "../drivers/keyboard.h"
 #include "../drivers/vga_color.h"
+#include "../drivers/ata.h"
 #include "kernel.h"
 #include "shell.h"
 #include "editor.h"
+#include "pager.h"
 #include "input.h"
+#include "klog.h"
+#include "bench.h"
+#include "filters.h"
 #include "../libc/string.h"
 #include <stdint.h>
 
 void kernel_main() {
     clear_screen();
+    klog_add_sink(kprint_log);
     init_gdt();
     set_kernel_stack(0x90000);
     isr_install();
     irq_install();
+    timer_calibrate();
     initialize_paging();
+    if (screen_use_framebuffer() == 0) {
+        klog(KLOG_INFO, "Framebuffer console, %dx%d", screen_cols(), screen_rows());
+    }
+    init_ata();
     init_fs();
+    init_mmap();
     init_syscalls();
     
     input_init();
     init_keyboard();
 
     shell_init();
+    klog_init();
+    bench_init();
+    filters_init();
+    klog_drain();
 
     kprint_color("Sem Kernel", VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
     kprint(" version 0.1\n");
     kprint_info("Kernel initialized successfully.\n");
+    klog_drain();
     kprint("type 'help' for commands.\n");
     shell_print_prompt();
     set_backspace_limit(get_cursor_offset());
+
+    // Everything else happens in interrupt handlers. In between, commit
+    // filesystem changes and show new log messages with interrupts off,
+    // as the handlers run.
+    while (1) {
+        uint32_t flags = irq_save();
+        fs_idle();
+        klog_drain();
+        irq_restore(flags);
+        asm volatile("hlt");
+    }
 }
 
 void user_input(char *input) {
     if (current_kernel_mode == MODE_SHELL) {
         shell_handle_input(input);
+        klog_drain(); // What the command logged goes above the prompt
         if (current_kernel_mode == MODE_SHELL) {
             shell_print_prompt();
         }
@@ -60,5 +91,7 @@ void user_key_press(uint8_t scancode) {
         }
     } else if (current_kernel_mode == MODE_EDIT) {
         editor_handle_key(scancode);
+    } else if (current_kernel_mode == MODE_PAGER) {
+        pager_handle_key(scancode);
     }
 }
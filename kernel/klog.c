@@ -0,0 +1,115 @@
+#include "klog.h"
+#include "shell.h"
+#include "../cpu/timer.h"
+#include "../drivers/screen.h"
+#include "../libc/printf.h"
+#include "../libc/mem.h"
+#include "../libc/function.h"
+#include <stdarg.h>
+
+/* Kernel log: the last KLOG_ENTRIES messages, in fixed-size entries.
+ * Logging never takes a lock and never touches the screen, so it works
+ * from any interrupt handler: a writer claims a sequence number with
+ * one atomic add, formats its text straight into that entry and then
+ * publishes the number. Entries reach the sinks (the console) later,
+ * when klog_drain() runs, and stay in the ring for 'dmesg'. */
+
+#define KLOG_BUSY 0xFFFFFFFF
+
+static klog_entry_t entries[KLOG_ENTRIES];
+static volatile uint32_t next_seq = 0;
+static uint32_t drained = 0;
+
+static klog_sink_t sinks[KLOG_MAX_SINKS];
+static int sink_count = 0;
+
+static char *level_names[] = { "INFO", "WARN", "ERROR" };
+
+void klog(uint8_t level, const char *fmt, ...) {
+    uint32_t seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    klog_entry_t *e = &entries[seq % KLOG_ENTRIES];
+    __atomic_store_n(&e->seq, KLOG_BUSY, __ATOMIC_RELAXED);
+
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(e->text, KLOG_TEXT, fmt, args);
+    va_end(args);
+    if (len > KLOG_TEXT - 1) len = KLOG_TEXT - 1;
+    if (len > 0 && e->text[len - 1] == '\n') e->text[--len] = '\0';
+
+    e->len = len;
+    e->level = level;
+    e->time_ms = timer_ms();
+    __atomic_store_n(&e->seq, seq, __ATOMIC_RELEASE);
+}
+
+/* Oldest entry still in the ring */
+uint32_t klog_first() {
+    uint32_t next = __atomic_load_n(&next_seq, __ATOMIC_ACQUIRE);
+    return next > KLOG_ENTRIES ? next - KLOG_ENTRIES : 0;
+}
+
+/**
+ * Copy entry '*seq' into 'entry' and advance '*seq'. Entries that were
+ * overwritten before being read are skipped. Returns 0 when there is
+ * nothing more to read, or the next entry is still being written.
+ */
+int klog_read(uint32_t *seq, klog_entry_t *entry) {
+    for (;;) {
+        uint32_t next = __atomic_load_n(&next_seq, __ATOMIC_ACQUIRE);
+        if (*seq == next) return 0;
+        if (next - *seq > KLOG_ENTRIES) *seq = next - KLOG_ENTRIES;
+
+        klog_entry_t *e = &entries[*seq % KLOG_ENTRIES];
+        if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != *seq) {
+            /* Being written: either this entry or, if we fell behind, a newer one */
+            if (next - *seq < KLOG_ENTRIES) return 0;
+            (*seq)++;
+            continue;
+        }
+        memory_copy((uint8_t*)e, (uint8_t*)entry, sizeof(klog_entry_t));
+        /* A writer may have reused the entry while we copied it */
+        if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != *seq) continue;
+        (*seq)++;
+        return 1;
+    }
+}
+
+int klog_add_sink(klog_sink_t sink) {
+    if (sink_count == KLOG_MAX_SINKS) return -1;
+    sinks[sink_count++] = sink;
+    return 0;
+}
+
+/* Hand every entry logged since the last call to the sinks */
+void klog_drain() {
+    if (sink_count == 0) return;
+    klog_entry_t entry;
+    while (klog_read(&drained, &entry)) {
+        for (int i = 0; i < sink_count; i++) sinks[i](&entry);
+    }
+}
+
+char *klog_level_name(uint8_t level) {
+    return level < sizeof(level_names) / sizeof(level_names[0]) ? level_names[level] : "?";
+}
+
+/* Print the whole ring, oldest first */
+void klog_dmesg() {
+    uint32_t seq = klog_first();
+    klog_entry_t entry;
+    while (klog_read(&seq, &entry)) {
+        kprintf("[%5u.%03u] %-5s %s\n", entry.time_ms / 1000, entry.time_ms % 1000,
+                klog_level_name(entry.level), entry.text);
+    }
+}
+
+static void dmesg_command(int argc, char **argv) {
+    klog_dmesg();
+    UNUSED(argc);
+    UNUSED(argv);
+}
+
+void klog_init() {
+    shell_register("dmesg", "dmesg", dmesg_command);
+}
@@ -0,0 +1,35 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdint.h>
+
+/* Levels */
+#define KLOG_INFO  0
+#define KLOG_WARN  1
+#define KLOG_ERROR 2
+
+#define KLOG_ENTRIES 512 /* Power of two */
+#define KLOG_TEXT 118
+#define KLOG_MAX_SINKS 4
+
+typedef struct {
+    volatile uint32_t seq; /* Sequence number, once the entry is complete */
+    uint32_t time_ms;      /* Since boot */
+    uint8_t level;
+    uint8_t len;
+    char text[KLOG_TEXT];  /* Without the trailing newline */
+} klog_entry_t;
+
+/* Receives every entry once, from klog_drain() */
+typedef void (*klog_sink_t)(klog_entry_t *entry);
+
+void klog(uint8_t level, const char *fmt, ...);
+int klog_add_sink(klog_sink_t sink);
+void klog_drain();
+int klog_read(uint32_t *seq, klog_entry_t *entry);
+uint32_t klog_first();
+char *klog_level_name(uint8_t level);
+void klog_dmesg();
+void klog_init();
+
+#endif
@@ -0,0 +1,112 @@
+#include "line_index.h"
+#include "../libc/mem.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define LINE_INDEX_MIN 256
+
+static uint32_t text_length(line_index_t *li) {
+    return gap_length(li->text);
+}
+
+static int grow(line_index_t *li) {
+    uint32_t size = li->size ? li->size * 2 : LINE_INDEX_MIN;
+    uint32_t *starts = (uint32_t*)krealloc((uint32_t)li->starts, size * sizeof(uint32_t));
+    if (!starts) return -1;
+
+    uint32_t tail = li->size - li->gap_end;
+    for (uint32_t i = 1; i <= tail; i++) starts[size - i] = starts[li->size - i];
+    li->starts = starts;
+    li->gap_end = size - tail;
+    li->size = size;
+    return 0;
+}
+
+/* Put the gap after 'line' entries, converting the ones it moves over */
+static void move_gap(line_index_t *li, uint32_t line) {
+    uint32_t len = text_length(li);
+    while (li->gap_start > line) {
+        li->gap_start--;
+        li->starts[--li->gap_end] = len - li->starts[li->gap_start];
+    }
+    while (li->gap_start < line) {
+        li->starts[li->gap_start++] = len - li->starts[li->gap_end++];
+    }
+}
+
+/* One scan of the text. Returns -1 when out of memory. */
+int line_index_build(line_index_t *li, gap_buffer_t *text) {
+    li->text = text;
+    li->starts = NULL;
+    li->size = li->gap_start = li->gap_end = 0;
+    if (grow(li) != 0) return -1;
+    li->starts[li->gap_start++] = 0;
+
+    uint32_t len = gap_length(text);
+    uint32_t pos = 0;
+    while (pos < len) {
+        uint32_t n;
+        char *span = gap_span(text, pos, &n);
+        for (uint32_t i = 0; i < n; i++) {
+            if (span[i] != '\n') continue;
+            if (li->gap_start == li->gap_end && grow(li) != 0) {
+                line_index_free(li);
+                return -1;
+            }
+            li->starts[li->gap_start++] = pos + i + 1;
+        }
+        pos += n;
+    }
+    return 0;
+}
+
+void line_index_free(line_index_t *li) {
+    kfree((uint32_t)li->starts);
+    li->starts = NULL;
+    li->size = li->gap_start = li->gap_end = 0;
+}
+
+uint32_t line_index_count(line_index_t *li) {
+    return li->size - (li->gap_end - li->gap_start);
+}
+
+uint32_t line_index_start(line_index_t *li, uint32_t line) {
+    if (line < li->gap_start) return li->starts[line];
+    return text_length(li) - li->starts[line + li->gap_end - li->gap_start];
+}
+
+/* Length of 'line', without its '\n' */
+uint32_t line_index_length(line_index_t *li, uint32_t line) {
+    uint32_t end = line + 1 < line_index_count(li) ? line_index_start(li, line + 1) - 1 : text_length(li);
+    return end - line_index_start(li, line);
+}
+
+/* The line holding offset 'pos', by binary search */
+uint32_t line_index_find(line_index_t *li, uint32_t pos) {
+    uint32_t lo = 0, hi = line_index_count(li) - 1;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (line_index_start(li, mid) <= pos) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+/**
+ * Account for 'c' about to be inserted at 'pos'. Must be called
+ * before the text changes. Returns -1 when out of memory, leaving the
+ * index as it was.
+ */
+int line_index_insert(line_index_t *li, uint32_t pos, char c) {
+    if (c == '\n' && li->gap_start == li->gap_end && grow(li) != 0) return -1;
+    move_gap(li, line_index_find(li, pos) + 1);
+    if (c == '\n') li->starts[li->gap_start++] = pos + 1;
+    return 0;
+}
+
+/* Account for the byte at 'pos' about to be deleted */
+void line_index_delete(line_index_t *li, uint32_t pos) {
+    move_gap(li, line_index_find(li, pos) + 1);
+    /* Joining two lines: the next one is right after the gap */
+    if (gap_at(li->text, pos) == '\n') li->gap_end++;
+}
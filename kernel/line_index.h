@@ -0,0 +1,28 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stdint.h>
+#include "gap_buffer.h"
+
+/* Where each line of a gap buffer starts. Like the text, the array
+ * has a gap, kept after the line being edited: entries before it hold
+ * offsets, entries after it hold the distance to the end of the text,
+ * so an edit only touches the entries it moves the gap over. */
+typedef struct {
+    gap_buffer_t *text;
+    uint32_t *starts;
+    uint32_t size;
+    uint32_t gap_start;
+    uint32_t gap_end;
+} line_index_t;
+
+int line_index_build(line_index_t *li, gap_buffer_t *text);
+void line_index_free(line_index_t *li);
+uint32_t line_index_count(line_index_t *li);
+uint32_t line_index_start(line_index_t *li, uint32_t line);
+uint32_t line_index_length(line_index_t *li, uint32_t line);
+uint32_t line_index_find(line_index_t *li, uint32_t pos);
+int line_index_insert(line_index_t *li, uint32_t pos, char c);
+void line_index_delete(line_index_t *li, uint32_t pos);
+
+#endif
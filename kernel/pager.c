@@ -0,0 +1,179 @@
+#include "pager.h"
+#include "editor.h"
+#include "input.h"
+#include "../drivers/screen.h"
+#include "../fs/fs.h"
+#include "../libc/string.h"
+#include "../libc/mem.h"
+#include "../libc/printf.h"
+#include "../libc/function.h"
+#include <stdint.h>
+
+extern void shell_print_prompt();
+
+/* 'less': a file is shown a screen at a time, read straight from the
+ * filesystem at the offset on screen. Nothing else of it is kept, so
+ * a file of any size costs one screen to show and one screen to move.
+ *
+ * Lines longer than the screen wrap every screen_cols() bytes, as in
+ * the editor. Going back a row means finding where its line starts,
+ * which is looked for in the PAGER_CHUNK bytes before it; lines longer
+ * than that are cut from wherever the look-back begins. */
+
+#define TEXT_ATTR   0x0F // White on black
+#define STATUS_ATTR 0x70 // Black on light grey
+
+static int32_t pager_fd = -1;
+static uint32_t file_size = 0;
+static uint32_t top = 0;       // Offset of the first byte on the screen
+static uint32_t second = 0;    // Where the second row starts
+static uint32_t bottom = 0;    // Offset just past the last row
+static uint32_t count = 0;     // Number typed before a command
+static uint8_t have_count = 0;
+
+static uint8_t window[MAX_ROWS * (MAX_COLS + 1)];
+static uint8_t chunk[PAGER_CHUNK];
+
+static int text_rows() {
+    return screen_rows() - 1;
+}
+
+static void pager_draw_status() {
+    char status[MAX_COLS + 1];
+    uint32_t percent = file_size ? (uint32_t)udiv64((uint64_t)bottom * 100, file_size) : 100;
+    int n = ksnprintf(status, sizeof(status), " %s  %u-%u of %u bytes (%u%%)  q: quit, g/G: top/end, Ng: byte N, N%%",
+                      fs_get_name(pager_fd), top, bottom, file_size, percent);
+    if (have_count) n = ksnprintf(status, sizeof(status), " :%u", count);
+
+    // Like the editor's status line, the last cell is left alone
+    int cols = screen_cols();
+    if (n > cols - 1) n = cols - 1;
+    memory_set((uint8_t*)status + n, ' ', cols - 1 - n);
+    status[cols - 1] = '\0';
+    kprint_at_color(status, 0, text_rows(), STATUS_ATTR);
+}
+
+/* Read what fits on the screen from 'top' and draw it, a row per write */
+static void pager_draw() {
+    uint32_t cols = screen_cols();
+    int32_t n = 0;
+    if (top < file_size) n = fs_read_at(pager_fd, top, window, text_rows() * (cols + 1));
+    if (n < 0) n = 0;
+
+    screen_begin();
+    char row[MAX_COLS + 1];
+    uint32_t i = 0;
+    for (int y = 0; y < text_rows(); y++) {
+        if (y == 1) second = top + i;
+        uint32_t len = 0;
+        if (i < (uint32_t)n) {
+            while (i < (uint32_t)n && len < cols && window[i] != '\n') {
+                char c = window[i++];
+                // NUL would end the string, the screen takes 0x08 as a backspace
+                row[len++] = c == 0 || c == 0x08 || c == '\r' ? ' ' : c;
+            }
+            if (len < cols && i < (uint32_t)n) i++; // The newline
+        } else {
+            row[len++] = '~'; // Past the end
+        }
+        memory_set((uint8_t*)row + len, ' ', cols - len);
+        row[cols] = '\0';
+        kprint_at_color(row, 0, y, TEXT_ATTR);
+    }
+    bottom = top + i;
+    pager_draw_status();
+    set_cursor(0, text_rows());
+    screen_end();
+}
+
+/* Start of the row holding byte 'off' */
+static uint32_t row_of(uint32_t off) {
+    uint32_t base = off > PAGER_CHUNK ? off - PAGER_CHUNK : 0;
+    int32_t n = fs_read_at(pager_fd, base, chunk, off - base);
+    uint32_t line = base;
+    for (int32_t i = n - 1; i >= 0; i--) {
+        if (chunk[i] == '\n') {
+            line = base + i + 1;
+            break;
+        }
+    }
+    return line + (off - line) / screen_cols() * screen_cols();
+}
+
+static uint32_t prev_row(uint32_t off) {
+    return off ? row_of(off - 1) : 0;
+}
+
+static void rows_up(int n) {
+    while (n-- > 0 && top > 0) top = prev_row(top);
+}
+
+/* Show the last screenful */
+static void go_end() {
+    top = file_size ? row_of(file_size - 1) : 0;
+    rows_up(text_rows() - 1);
+}
+
+void pager_open(int32_t fd) {
+    pager_fd = fd;
+    file_size = fs_get_size(fd);
+    top = 0;
+    have_count = 0;
+    current_kernel_mode = MODE_PAGER;
+    clear_screen();
+    pager_draw();
+}
+
+static void pager_close() {
+    pager_fd = -1;
+    current_kernel_mode = MODE_SHELL;
+    clear_screen();
+    shell_print_prompt();
+    set_backspace_limit(get_cursor_offset());
+}
+
+void pager_handle_char(char c) {
+    if (c >= '0' && c <= '9') {
+        count = (have_count ? count * 10 : 0) + (c - '0');
+        have_count = 1;
+        pager_draw_status();
+        return;
+    }
+
+    uint32_t n = have_count ? count : 0;
+    have_count = 0;
+    if (c == 'q') {
+        pager_close();
+        return;
+    } else if (c == ' ' || c == 'f') {
+        if (bottom < file_size) top = bottom;
+    } else if (c == 'b') {
+        rows_up(text_rows());
+    } else if (c == 'j' || c == '\n') {
+        if (bottom < file_size) top = second;
+    } else if (c == 'k') {
+        rows_up(1);
+    } else if (c == 'g' || c == '%') {
+        // To byte N, or N percent of the way
+        if (c == '%') n = (uint32_t)udiv64((uint64_t)file_size * (n < 100 ? n : 100), 100);
+        if (n < file_size) top = row_of(n);
+        else go_end();
+    } else if (c == 'G') {
+        go_end();
+    }
+    pager_draw();
+}
+
+void pager_handle_key(uint8_t scancode) {
+    have_count = 0;
+    if (scancode == SC_DOWN) {
+        if (bottom < file_size) top = second;
+    } else if (scancode == SC_UP) {
+        rows_up(1);
+    } else if (scancode == SC_PGDN) {
+        if (bottom < file_size) top = bottom;
+    } else if (scancode == SC_PGUP) {
+        rows_up(text_rows());
+    }
+    pager_draw();
+}
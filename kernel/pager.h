@@ -0,0 +1,12 @@
+#ifndef PAGER_H
+#define PAGER_H
+
+#include <stdint.h>
+
+#define PAGER_CHUNK 1024 /* How far back to look for the start of a line */
+
+void pager_open(int32_t fd);
+void pager_handle_char(char c);
+void pager_handle_key(uint8_t scancode);
+
+#endif
@@ -0,0 +1,64 @@
+#include "pipe.h"
+#include "../libc/mem.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Pipes between shell commands. There is a single thread of control,
+ * so a full pipe cannot make its writer wait: it hands what it holds to
+ * the reader, which takes all of it there and then. The reader sees the
+ * bytes where they already are, in the ring or, for a write of a page
+ * or more, in the writer's own buffer, so bulk data is not copied on
+ * the way through. */
+
+/* Give the pipe a page for its ring. Returns -1 if there is none. */
+int pipe_init(pipe_t *p, pipe_reader_t reader, void *data) {
+    uint32_t page = kpage_alloc();
+    if (!page) return -1;
+    p->buf = (char*)page;
+    p->head = 0;
+    p->tail = 0;
+    p->reader = reader;
+    p->data = data;
+    return 0;
+}
+
+/* Drop the ring. Whatever was not flushed is lost. */
+void pipe_free(pipe_t *p) {
+    if (p->buf) kpage_free((uint32_t)p->buf);
+    p->buf = NULL;
+}
+
+/* Hand everything in the ring to the reader: one span, or two when it
+ * wraps around the end of the page. The reader must not write to the
+ * same pipe. */
+void pipe_flush(pipe_t *p) {
+    while (p->tail != p->head) {
+        uint32_t at = p->tail % PIPE_SIZE;
+        uint32_t n = p->head - p->tail;
+        if (n > PIPE_SIZE - at) n = PIPE_SIZE - at;
+        p->reader(p, p->buf + at, n);
+        p->tail += n;
+    }
+}
+
+void pipe_write(pipe_t *p, char *data, uint32_t len) {
+    /* A page or more would only fill the ring over and over: pass it on
+     * as it is, after what is queued in front of it */
+    if (len >= PIPE_SIZE) {
+        pipe_flush(p);
+        p->reader(p, data, len);
+        return;
+    }
+
+    while (len) {
+        if (p->head - p->tail == PIPE_SIZE) pipe_flush(p);
+        uint32_t at = p->head % PIPE_SIZE;
+        uint32_t n = PIPE_SIZE - (p->head - p->tail);
+        if (n > PIPE_SIZE - at) n = PIPE_SIZE - at;
+        if (n > len) n = len;
+        memory_copy((uint8_t*)data, (uint8_t*)p->buf + at, n);
+        p->head += n;
+        data += n;
+        len -= n;
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include <stdint.h>
+
+#define PIPE_SIZE 4096 /* One page, a power of two */
+
+typedef struct pipe pipe_t;
+
+/* Takes bytes out of a pipe, all of the ones it is given */
+typedef void (*pipe_reader_t)(pipe_t *p, char *data, uint32_t len);
+
+struct pipe {
+    char *buf;            /* Ring of PIPE_SIZE bytes */
+    uint32_t head;        /* Next byte to write, grows forever */
+    uint32_t tail;        /* Next byte to read */
+    pipe_reader_t reader;
+    void *data;           /* For the reader */
+};
+
+int pipe_init(pipe_t *p, pipe_reader_t reader, void *data);
+void pipe_free(pipe_t *p);
+void pipe_write(pipe_t *p, char *data, uint32_t len);
+void pipe_flush(pipe_t *p);
+
+#endif
@@ -1,15 +1,21 @@
 #include "shell.h"
 #include "editor.h"
+#include "pager.h"
 #include "input.h"
+#include "pipe.h"
 #include "../drivers/screen.h"
 #include "../drivers/vga_color.h"
 #include "../drivers/keyboard.h"
 #include "../fs/fs.h"
+#include "../fs/mmap.h"
+#include "../fs/file.h"
 #include "../libc/string.h"
+#include "../libc/mem.h"
+#include "../libc/function.h"
 #include "../cpu/ports.h"
 #include <stdint.h>
 
-static int16_t current_dir_idx = -1;
+static int32_t current_dir_idx = -1;
 
 #define MAX_HISTORY 10
 static char history[MAX_HISTORY][256];
@@ -18,14 +24,8 @@ static int history_index = -1;
 
 extern void jump_to_user_mode();
 
-void shell_init() {
-    int32_t home = fs_open("home", -1);
-    int32_t user = fs_open("user", home);
-    current_dir_idx = user;
-    
-    for (int i = 0; i < MAX_HISTORY; i++) {
-        history[i][0] = '\0';
-    }
+int32_t shell_get_dir() {
+    return current_dir_idx;
 }
 
 void shell_print_prompt() {
@@ -74,77 +74,454 @@ void shell_history_down() {
     }
 }
 
-void shell_handle_input(char *input) {
-    shell_history_add(input);
+/* Commands are found by name in a hash table with open addressing.
+ * The slots hold indices into 'commands', which stays in the order
+ * commands were registered, for 'help'. */
+typedef struct {
+    char *name;
+    char *usage;
+    shell_command_t handler;
+    shell_filter_t *filter; // Or this, for commands that read input
+} command_t;
+
+static command_t commands[SHELL_MAX_COMMANDS];
+static int command_count = 0;
+static uint8_t slots[SHELL_SLOTS]; // Command index + 1, 0 when empty
+
+static uint32_t command_hash(char *name) {
+    uint32_t h = 2166136261u; // FNV-1a
+    while (*name) h = (h ^ (uint8_t)*name++) * 16777619u;
+    return h;
+}
+
+/* The slot holding 'name', or the empty one where it would go */
+static uint32_t command_slot(char *name) {
+    uint32_t i = command_hash(name) & (SHELL_SLOTS - 1);
+    while (slots[i] && strcmp(commands[slots[i] - 1].name, name) != 0) i = (i + 1) & (SHELL_SLOTS - 1);
+    return i;
+}
+
+static int add_command(char *name, char *usage, shell_command_t handler, shell_filter_t *filter) {
+    if (command_count == SHELL_MAX_COMMANDS) return -1;
+    uint32_t i = command_slot(name);
+    if (slots[i]) return -1;
+    commands[command_count].name = name;
+    commands[command_count].usage = usage;
+    commands[command_count].handler = handler;
+    commands[command_count].filter = filter;
+    slots[i] = ++command_count;
+    return 0;
+}
 
-    if (strcmp(input, "exit") == 0) {
-        kprint("Shutting down...\n");
-        port_word_out(0x604, 0x2000);
-        port_word_out(0xB004, 0x2000);
-        port_word_out(0x4004, 0x3400);
-        asm volatile("hlt");
-    } else if (strcmp(input, "help") == 0) {
-        kprint("Commands: ls, cd <dir>, mkdir <dir>, touch <file>, rm <file/dir>, cat <file>, edit <file>, user, clear, exit\n");
-    } else if (strcmp(input, "ls") == 0) {
-        fs_list(current_dir_idx);
-    } else if (strncmp(input, "touch ", 6) == 0) {
-        char *file = input + 6;
-        if (fs_create(file, current_dir_idx, 0) == -1) {
-            kprint("Error creating file.\n");
+/**
+ * Make 'name' a shell command. 'usage' is what 'help' shows for it.
+ * The strings are kept, not copied. Returns -1 if the name is taken or
+ * the table is full.
+ */
+int shell_register(char *name, char *usage, shell_command_t handler) {
+    return add_command(name, usage, handler, NULL);
+}
+
+/* The same for a command that can come after '|'. 'filter' is kept. */
+int shell_register_filter(char *name, char *usage, shell_filter_t *filter) {
+    return add_command(name, usage, NULL, filter);
+}
+
+static command_t *find_command(char *name) {
+    uint8_t index = slots[command_slot(name)];
+    return index ? &commands[index - 1] : NULL;
+}
+
+/* Split 'input' in place at spaces. '|', '>' and '>>' are words of
+ * their own, with or without spaces around them. Returns the number of
+ * words, or -1 if there are too many. */
+static int shell_tokenize(char *input, char **argv) {
+    int argc = 0;
+    while (*input) {
+        while (*input == ' ') *input++ = '\0';
+        if (!*input) break;
+        if (argc == SHELL_MAX_ARGS) return -1;
+        if (*input == '|' || *input == '>') {
+            // Overwritten to end the word before it
+            uint8_t append = input[0] == '>' && input[1] == '>';
+            argv[argc++] = input[0] == '|' ? "|" : append ? ">>" : ">";
+            *input++ = '\0';
+            if (append) *input++ = '\0';
+            continue;
         }
-    } else if (strncmp(input, "cd ", 3) == 0) {
-        char *dir = input + 3;
-        if (strcmp(dir, "/") == 0) {
-            current_dir_idx = -1;
-        } else {
-            int32_t fd = fs_open(dir, current_dir_idx);
-            if (fd != -1 && fs_is_dir(fd)) {
-                current_dir_idx = fd;
-            } else if (fd != -1 && !fs_is_dir(fd)) {
-                kprint("Not a directory.\n");
-            } else {
-                kprint("Directory not found.\n");
+        argv[argc++] = input;
+        while (*input && *input != ' ' && *input != '|' && *input != '>') input++;
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+/* A pipeline runs its commands one after the other, there being no
+ * processes: each prints into a pipe, which feeds the next one, as a
+ * filter, whenever it fills up. The last one prints to the screen or,
+ * through one more pipe, to the file after '>' or '>>'. */
+typedef struct {
+    command_t *command;
+    int argc;
+    char **argv;
+    pipe_t *out; // NULL for the screen
+    void *state; // A filter's own
+} stage_t;
+
+static pipe_t *output = NULL; // Where commands print now
+static int32_t output_file = -1;
+static uint8_t output_failed = 0;
+
+static void print_to_pipe(char *data, uint32_t len) {
+    pipe_write(output, data, len);
+}
+
+static void set_output(pipe_t *p) {
+    output = p;
+    screen_redirect(p ? print_to_pipe : NULL);
+}
+
+/* Reader of the pipe into a stage. Its output goes on down the line. */
+static void feed_stage(pipe_t *p, char *data, uint32_t len) {
+    stage_t *stage = p->data;
+    pipe_t *prev = output;
+    set_output(stage->out);
+    stage->command->filter->data(stage->state, data, len);
+    set_output(prev);
+}
+
+static void feed_file(pipe_t *p, char *data, uint32_t len) {
+    if (file_write(output_file, (uint8_t*)data, len) != (int32_t)len) output_failed = 1;
+    UNUSED(p);
+}
+
+/* Cut the words into stages at '|', and take the path after a final
+ * '>' or '>>'. Returns the number of stages, or -1 after saying why. */
+static int parse_pipeline(int argc, char **argv, stage_t *stages, char **path, uint8_t *append) {
+    int count = 0;
+    int start = 0;
+    *path = NULL;
+    for (int i = 0; i <= argc; i++) {
+        char *word = argv[i];
+        if (word && word[0] != '|' && word[0] != '>') continue;
+
+        if (i == start) {
+            kprint("Missing command.\n");
+            return -1;
+        }
+        if (count == SHELL_MAX_STAGES) {
+            kprint("Too many commands.\n");
+            return -1;
+        }
+        stages[count].command = find_command(argv[start]);
+        stages[count].argc = i - start;
+        stages[count].argv = &argv[start];
+        stages[count].out = NULL;
+        stages[count].state = NULL;
+        if (!stages[count].command) {
+            kprint("Unknown command: ");
+            kprint(argv[start]);
+            kprint("\n");
+            return -1;
+        }
+        if (count > 0 && !stages[count].command->filter) {
+            kprint(argv[start]);
+            kprint(": does not read input.\n");
+            return -1;
+        }
+        count++;
+        argv[i] = NULL;
+        start = i + 1;
+
+        if (word && word[0] == '>') {
+            if (i + 2 != argc) {
+                kprint("Usage: <command> > <path>\n");
+                return -1;
             }
+            *path = argv[i + 1];
+            *append = word[1] == '>';
+            break;
         }
-    } else if (strncmp(input, "mkdir ", 6) == 0) {
-        char *dir = input + 6;
-        if (fs_create(dir, current_dir_idx, 1) == -1) {
-            kprint("Error creating directory.\n");
+    }
+    return count;
+}
+
+static int32_t open_output(char *path, uint8_t append) {
+    int32_t dir;
+    char name[MAX_FILENAME];
+    if (fs_split_path(path, current_dir_idx, &dir, name) != 0) return -1;
+    return file_open(name, dir, O_WRITE | O_CREATE | (append ? O_APPEND : O_TRUNC));
+}
+
+static void free_states(stage_t *stages, int count) {
+    for (int i = 0; i < count; i++) {
+        if (stages[i].state) kfree((uint32_t)stages[i].state);
+        stages[i].state = NULL;
+    }
+}
+
+/* Give each filter its state and let it check its words, before
+ * anything runs. Returns -1 after saying why not. */
+static int start_filters(stage_t *stages, int count) {
+    for (int i = 0; i < count; i++) {
+        shell_filter_t *filter = stages[i].command->filter;
+        if (!filter) continue;
+        stages[i].state = (void*)kmalloc(filter->size, 0, NULL);
+        if (!stages[i].state) {
+            kprint("Out of memory.\n");
+            return -1;
         }
-    } else if (strncmp(input, "rm ", 3) == 0) {
-        char *file = input + 3;
-        int32_t res = fs_delete(file, current_dir_idx);
-        if (res == -1) {
-            kprint("Not found.\n");
+        if (filter->start(stages[i].state, stages[i].argc, stages[i].argv) != 0) return -1;
+    }
+    return 0;
+}
+
+static void run_pipeline(stage_t *stages, int count, char *path, uint8_t append) {
+    pipe_t pipes[SHELL_MAX_STAGES];
+    int pipe_count = path ? count : count - 1;
+
+    if (start_filters(stages, count) != 0) {
+        free_states(stages, count);
+        return;
+    }
+    if (path && (output_file = open_output(path, append)) == -1) {
+        free_states(stages, count);
+        kprint("Cannot open file.\n");
+        return;
+    }
+    for (int i = 0; i < pipe_count; i++) {
+        if (pipe_init(&pipes[i], i + 1 < count ? feed_stage : feed_file, &stages[i + 1]) != 0) {
+            while (i--) pipe_free(&pipes[i]);
+            if (path) file_close(output_file);
+            free_states(stages, count);
+            kprint("Out of memory.\n");
+            return;
         }
-        else if (res == -2) kprint("Error deleting directory: Directory not empty.\n");
-    } else if (strncmp(input, "cat ", 4) == 0) {
-        char *filename = input + 4;
-        int32_t fd = fs_open(filename, current_dir_idx);
-        if (fd == -1 || fs_is_dir(fd)) {
-            kprint("File not found.\n");
-        } else {
-            uint32_t size = fs_get_size(fd);
-            char content[2048];
-            fs_read(fd, (uint8_t*)content, size);
-            content[size] = '\0';
-            kprint(content);
-            kprint("\n");
+        stages[i].out = &pipes[i];
+    }
+    output_failed = 0;
+
+    // The first command has no input: a filter there just ends
+    set_output(stages[0].out);
+    if (stages[0].command->filter) stages[0].command->filter->end(stages[0].state);
+    else stages[0].command->handler(stages[0].argc, stages[0].argv);
+
+    // Then each pipe is emptied into the next command, which is told
+    // its input is over and may print a last word into its own pipe
+    for (int i = 0; i < pipe_count; i++) {
+        pipe_flush(&pipes[i]);
+        if (i + 1 < count) {
+            set_output(stages[i + 1].out);
+            stages[i + 1].command->filter->end(stages[i + 1].state);
         }
-    } else if (strncmp(input, "edit ", 5) == 0) {
-        char *filename = input + 5;
-        editor_init(filename, current_dir_idx);
-    } else if (strcmp(input, "user") == 0) {
-        kprint("Jumping to User Mode...\n");
-        jump_to_user_mode();
-        kprint("\nReturned from User Mode.\n");
-        shell_print_prompt();
-        set_backspace_limit(get_cursor_offset());
-    } else if (strcmp(input, "clear") == 0) {
-        clear_screen();
-    } else if (strlen(input) > 0) {
-        kprint("Unknown command: ");
-        kprint(input);
+    }
+    set_output(NULL);
+
+    for (int i = 0; i < pipe_count; i++) pipe_free(&pipes[i]);
+    free_states(stages, count);
+    if (path) {
+        file_close(output_file);
+        output_file = -1;
+        if (output_failed) kprint("Error writing file.\n");
+    }
+}
+
+void shell_handle_input(char *input) {
+    shell_history_add(input);
+
+    char *argv[SHELL_MAX_ARGS + 1];
+    int argc = shell_tokenize(input, argv);
+    if (argc == 0) return;
+    if (argc == -1) {
+        kprint("Too many arguments.\n");
+        return;
+    }
+
+    stage_t stages[SHELL_MAX_STAGES];
+    char *path;
+    uint8_t append = 0;
+    int count = parse_pipeline(argc, argv, stages, &path, &append);
+    if (count == -1) return;
+
+    // A plain command prints straight to the screen
+    if (count == 1 && !path && !stages[0].command->filter) {
+        stages[0].command->handler(argc, argv);
+        return;
+    }
+    run_pipeline(stages, count, path, append);
+}
+
+/* For commands that take a path: print the usage if it is missing */
+static int need_path(int argc, char **argv) {
+    if (argc >= 2) return 1;
+    kprint("Usage: ");
+    kprint(argv[0]);
+    kprint(" <path>\n");
+    return 0;
+}
+
+static void cmd_exit(int argc, char **argv) {
+    kprint("Shutting down...\n");
+    fs_sync();
+    port_word_out(0x604, 0x2000);
+    port_word_out(0xB004, 0x2000);
+    port_word_out(0x4004, 0x3400);
+    asm volatile("hlt");
+    UNUSED(argc);
+    UNUSED(argv);
+}
+
+static void cmd_help(int argc, char **argv) {
+    kprint("Commands: ");
+    for (int i = 0; i < command_count; i++) {
+        if (i) kprint(", ");
+        kprint(commands[i].usage);
+    }
+    kprint("\n");
+    UNUSED(argc);
+    UNUSED(argv);
+}
+
+static void cmd_ls(int argc, char **argv) {
+    fs_list(current_dir_idx, argc >= 2 && strcmp(argv[1], "-s") == 0);
+}
+
+static void cmd_touch(int argc, char **argv) {
+    if (!need_path(argc, argv)) return;
+    int32_t dir;
+    char name[MAX_FILENAME];
+    if (fs_split_path(argv[1], current_dir_idx, &dir, name) != 0
+            || fs_create(name, dir, 0) == -1) {
+        kprint("Error creating file.\n");
+    }
+}
+
+static void cmd_cd(int argc, char **argv) {
+    if (!need_path(argc, argv)) return;
+    int32_t fd;
+    if (fs_lookup_path(argv[1], current_dir_idx, &fd) != 0) {
+        kprint("Directory not found.\n");
+    } else if (fd != -1 && !fs_is_dir(fd)) {
+        kprint("Not a directory.\n");
+    } else {
+        current_dir_idx = fd;
+    }
+}
+
+static void cmd_mkdir(int argc, char **argv) {
+    if (!need_path(argc, argv)) return;
+    int32_t dir;
+    char name[MAX_FILENAME];
+    if (fs_split_path(argv[1], current_dir_idx, &dir, name) != 0
+            || fs_create(name, dir, 1) == -1) {
+        kprint("Error creating directory.\n");
+    }
+}
+
+static void cmd_rm(int argc, char **argv) {
+    if (!need_path(argc, argv)) return;
+    int32_t dir;
+    char name[MAX_FILENAME];
+    int32_t res = -1;
+    if (fs_split_path(argv[1], current_dir_idx, &dir, name) == 0) {
+        res = fs_delete(name, dir);
+    }
+    if (res == -1) {
+        kprint("Not found.\n");
+    }
+    else if (res == -2) kprint("Error deleting directory: Directory not empty.\n");
+    else if (res == -3) kprint("Error deleting file: File is in use.\n");
+}
+
+/* The file named by argv[1], or -1 after saying why not */
+static int32_t open_file_arg(int argc, char **argv) {
+    if (!need_path(argc, argv)) return -1;
+    int32_t fd;
+    if (fs_lookup_path(argv[1], current_dir_idx, &fd) != 0 || fd == -1 || fs_is_dir(fd)) {
+        kprint("File not found.\n");
+        return -1;
+    }
+    return fd;
+}
+
+static void cmd_cat(int argc, char **argv) {
+    int32_t fd = open_file_arg(argc, argv);
+    if (fd == -1) return;
+
+    // Print straight from a mapping of the file
+    uint32_t size = fs_get_size(fd);
+    uint32_t data = size ? fs_mmap(fd, 0, size, MAP_READ) : 0;
+    if (data) {
+        kprint_len((char*)data, size);
+        fs_munmap(data);
         kprint("\n");
+        return;
+    }
+
+    // Or in chunks, if it cannot be mapped
+    char chunk[513];
+    uint32_t offset = 0;
+    int32_t n;
+    while ((n = fs_read_at(fd, offset, (uint8_t*)chunk, sizeof(chunk) - 1)) > 0) {
+        chunk[n] = '\0';
+        kprint(chunk);
+        offset += n;
+    }
+    kprint("\n");
+}
+
+static void cmd_less(int argc, char **argv) {
+    int32_t fd = open_file_arg(argc, argv);
+    if (fd != -1) pager_open(fd);
+}
+
+static void cmd_edit(int argc, char **argv) {
+    if (!need_path(argc, argv)) return;
+    int32_t dir;
+    char name[MAX_FILENAME];
+    if (fs_split_path(argv[1], current_dir_idx, &dir, name) == 0) {
+        editor_init(name, dir);
+    } else {
+        kprint("Cannot open file.\n");
+    }
+}
+
+static void cmd_user(int argc, char **argv) {
+    kprint("Jumping to User Mode...\n");
+    jump_to_user_mode();
+    kprint("\nReturned from User Mode.\n");
+    shell_print_prompt();
+    set_backspace_limit(get_cursor_offset());
+    UNUSED(argc);
+    UNUSED(argv);
+}
+
+static void cmd_clear(int argc, char **argv) {
+    clear_screen();
+    UNUSED(argc);
+    UNUSED(argv);
+}
+
+void shell_init() {
+    int32_t home = fs_open("home", -1);
+    int32_t user = fs_open("user", home);
+    current_dir_idx = user;
+    
+    for (int i = 0; i < MAX_HISTORY; i++) {
+        history[i][0] = '\0';
     }
+
+    // The shell's own commands. Subsystems register theirs at init.
+    shell_register("help", "help", cmd_help);
+    shell_register("ls", "ls [-s]", cmd_ls);
+    shell_register("cd", "cd <path>", cmd_cd);
+    shell_register("mkdir", "mkdir <path>", cmd_mkdir);
+    shell_register("touch", "touch <path>", cmd_touch);
+    shell_register("rm", "rm <path>", cmd_rm);
+    shell_register("cat", "cat <path>", cmd_cat);
+    shell_register("less", "less <path>", cmd_less);
+    shell_register("edit", "edit <path>", cmd_edit);
+    shell_register("user", "user", cmd_user);
+    shell_register("clear", "clear", cmd_clear);
+    shell_register("exit", "exit", cmd_exit);
 }
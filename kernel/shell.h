@@ -3,10 +3,33 @@
 
 #include <stdint.h>
 
+#define SHELL_MAX_ARGS 16
+#define SHELL_MAX_COMMANDS 64
+#define SHELL_SLOTS 128 /* Hash table size: a power of two, at least twice the commands */
+#define SHELL_MAX_STAGES 8 /* Commands in one pipeline, each printing into a pipe */
+
+/* A command gets its words: argv[0] is its name, argv[argc] is NULL */
+typedef void (*shell_command_t)(int argc, char **argv);
+
+/* A command that reads what the one before it in a pipeline prints.
+ * Each use of it gets 'size' bytes of state of its own. 'start' gets
+ * that and the words, and returns -1 to give up, after saying why.
+ * 'data' then gets the input as it comes, and 'end' is called when it
+ * is over. The words stay valid until then. */
+typedef struct {
+    uint32_t size;
+    int (*start)(void *state, int argc, char **argv);
+    void (*data)(void *state, char *data, uint32_t len);
+    void (*end)(void *state);
+} shell_filter_t;
+
 void shell_init();
 void shell_print_prompt();
+int32_t shell_get_dir();
 void shell_handle_input(char *input);
 void shell_history_up();
 void shell_history_down();
+int shell_register(char *name, char *usage, shell_command_t handler);
+int shell_register_filter(char *name, char *usage, shell_filter_t *filter);
 
 #endif
@@ -0,0 +1,152 @@
+#include "undo.h"
+#include "../libc/mem.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* Edits are logged as they are made, not as copies of the text, so the
+ * log grows with the edits and not with the file. Typing extends the
+ * last insert, and a run of backspaces the last delete, until something
+ * else happens in between: a whole run then goes in one step. Stepping
+ * back or forward hands out one record; applying it costs its length.
+ *
+ * Both arrays double when full. If that fails the history is dropped:
+ * a log with an edit missing would undo the wrong bytes. */
+
+#define UNDO_MIN_RECORDS 64
+#define UNDO_MIN_BYTES 1024
+
+void undo_init(undo_log_t *u) {
+    u->records = NULL;
+    u->bytes = NULL;
+    u->count = u->capacity = u->done = 0;
+    u->used = u->size = 0;
+}
+
+void undo_free(undo_log_t *u) {
+    if (u->records) kfree((uint32_t)u->records);
+    if (u->bytes) kfree((uint32_t)u->bytes);
+    undo_init(u);
+}
+
+/* Forget everything, keeping the memory */
+void undo_clear(undo_log_t *u) {
+    u->count = u->done = u->used = 0;
+}
+
+/* A new edit: whatever was undone can no longer be redone */
+static void drop_redo(undo_log_t *u) {
+    if (u->done == u->count) return;
+    u->count = u->done;
+    u->used = u->count ? u->records[u->count - 1].data + u->records[u->count - 1].len : 0;
+}
+
+static int reserve(undo_log_t *u, uint32_t records, uint32_t bytes) {
+    if (u->count + records > u->capacity) {
+        uint32_t capacity = u->capacity ? u->capacity : UNDO_MIN_RECORDS;
+        while (capacity < u->count + records) capacity *= 2;
+        undo_record_t *r = (undo_record_t*)krealloc((uint32_t)u->records, capacity * sizeof(undo_record_t));
+        if (!r) return -1;
+        u->records = r;
+        u->capacity = capacity;
+    }
+    if (u->used + bytes > u->size) {
+        uint32_t size = u->size ? u->size : UNDO_MIN_BYTES;
+        while (size < u->used + bytes) size *= 2;
+        char *b = (char*)krealloc((uint32_t)u->bytes, size);
+        if (!b) return -1;
+        u->bytes = b;
+        u->size = size;
+    }
+    return 0;
+}
+
+/* The last record, if the next edit may extend it */
+static undo_record_t *open_record(undo_log_t *u, uint8_t kind) {
+    if (u->count == 0) return NULL;
+    undo_record_t *r = &u->records[u->count - 1];
+    return r->kind == kind && !(r->flags & UNDO_SEALED) ? r : NULL;
+}
+
+static undo_record_t *new_record(undo_log_t *u, uint8_t kind, uint32_t pos, uint8_t flags) {
+    undo_record_t *r = &u->records[u->count++];
+    u->done = u->count;
+    r->pos = pos;
+    r->len = 0;
+    r->data = u->used;
+    r->kind = kind;
+    r->flags = flags;
+    return r;
+}
+
+/* 'c' was typed at 'pos'. Returns -1 when out of memory (the history is gone). */
+int undo_insert(undo_log_t *u, uint32_t pos, char c) {
+    drop_redo(u);
+    if (reserve(u, 1, 1) != 0) {
+        undo_clear(u);
+        return -1;
+    }
+    undo_record_t *r = open_record(u, UNDO_INSERT);
+    if (!r || r->pos + r->len != pos) r = new_record(u, UNDO_INSERT, pos, 0);
+    u->bytes[u->used++] = c;
+    r->len++;
+    return 0;
+}
+
+/* 'c' at 'pos' is being deleted. A delete right before the last one
+ * (backspace) extends it, with the bytes kept last first. */
+int undo_delete(undo_log_t *u, uint32_t pos, char c) {
+    drop_redo(u);
+    if (reserve(u, 1, 1) != 0) {
+        undo_clear(u);
+        return -1;
+    }
+    undo_record_t *r = open_record(u, UNDO_DELETE);
+    if (r && (r->flags & UNDO_BACKWARD) && r->pos == pos + 1) {
+        r->pos = pos;
+    } else {
+        r = new_record(u, UNDO_DELETE, pos, UNDO_BACKWARD);
+    }
+    u->bytes[u->used++] = c;
+    r->len++;
+    return 0;
+}
+
+/* Log 'len' bytes inserted or deleted at once. 'joined' ties it to the
+ * record before, so that a change made of several goes in one step. */
+int undo_add(undo_log_t *u, uint8_t kind, uint32_t pos, char *data, uint32_t len, int joined) {
+    drop_redo(u);
+    if (reserve(u, 1, len) != 0) {
+        undo_clear(u);
+        return -1;
+    }
+    undo_record_t *r = new_record(u, kind, pos, UNDO_SEALED | (joined ? UNDO_JOINED : 0));
+    memory_copy((uint8_t*)data, (uint8_t*)u->bytes + u->used, len);
+    u->used += len;
+    r->len = len;
+    return 0;
+}
+
+/* The run being typed is over: the next edit starts a new record */
+void undo_seal(undo_log_t *u) {
+    if (u->count) u->records[u->count - 1].flags |= UNDO_SEALED;
+}
+
+/* The record to revert, or NULL at the start of the history */
+undo_record_t *undo_back(undo_log_t *u) {
+    if (u->done == 0) return NULL;
+    undo_record_t *r = &u->records[--u->done];
+    r->flags |= UNDO_SEALED;
+    return r;
+}
+
+/* The record to apply again, or NULL if nothing was undone */
+undo_record_t *undo_forward(undo_log_t *u) {
+    if (u->done == u->count) return NULL;
+    return &u->records[u->done++];
+}
+
+/* Byte 'i' of what 'r' inserted or deleted, in text order */
+char undo_byte(undo_log_t *u, undo_record_t *r, uint32_t i) {
+    if (r->flags & UNDO_BACKWARD) i = r->len - 1 - i;
+    return u->bytes[r->data + i];
+}
@@ -0,0 +1,46 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include <stdint.h>
+
+#define UNDO_INSERT 0
+#define UNDO_DELETE 1
+
+#define UNDO_BACKWARD 0x01 /* Bytes kept last first: a run of backspaces */
+#define UNDO_JOINED   0x02 /* Undone and redone with the record before */
+#define UNDO_SEALED   0x04 /* Later edits start a record of their own */
+
+/* One edit: 'len' bytes inserted or deleted at 'pos' */
+typedef struct {
+    uint32_t pos;
+    uint32_t len;
+    uint32_t data;  /* Where the bytes are in the log's byte store */
+    uint8_t kind;
+    uint8_t flags;
+} undo_record_t;
+
+/* The records before 'done' have been applied, the ones from it on
+ * were undone and can be redone. The bytes of every record are packed
+ * in 'bytes', in the same order as the records. */
+typedef struct {
+    undo_record_t *records;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t done;
+    char *bytes;
+    uint32_t used;
+    uint32_t size;
+} undo_log_t;
+
+void undo_init(undo_log_t *u);
+void undo_free(undo_log_t *u);
+void undo_clear(undo_log_t *u);
+int undo_insert(undo_log_t *u, uint32_t pos, char c);
+int undo_delete(undo_log_t *u, uint32_t pos, char c);
+int undo_add(undo_log_t *u, uint8_t kind, uint32_t pos, char *data, uint32_t len, int joined);
+void undo_seal(undo_log_t *u);
+undo_record_t *undo_back(undo_log_t *u);
+undo_record_t *undo_forward(undo_log_t *u);
+char undo_byte(undo_log_t *u, undo_record_t *r, uint32_t i);
+
+#endif
@@ -1,8 +1,21 @@
 #ifndef FUNCTION_H
 #define FUNCTION_H
 
+#include <stdint.h>
+
 /* Sometimes we want to keep parameters to a function for later use
  * and this is a solution to avoid the 'unused parameter' compiler warning */
 #define UNUSED(x) (void)(x)
 
+/* 64 by 32 bit division. We do not link libgcc, so plain '/' on a
+ * uint64_t would leave __udivdi3 undefined: do it as two divl steps. */
+static inline uint64_t udiv64(uint64_t n, uint32_t d) {
+    uint32_t hi = n >> 32;
+    uint32_t q_hi = hi / d;
+    uint32_t r = hi % d;
+    uint32_t q_lo;
+    asm("divl %4" : "=a"(q_lo), "=d"(r) : "a"((uint32_t)n), "d"(r), "rm"(d));
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
 #endif
@@ -1,10 +1,12 @@
 #include "mem.h"
 
+/* Copies forwards, a dword at a time, so overlapping ranges are fine
+ * as long as 'dest' is below 'source' */
 void memory_copy(uint8_t *source, uint8_t *dest, size_t nbytes) {
-    size_t i;
-    for (i = 0; i < nbytes; i++) {
-        *(dest + i) = *(source + i);
-    }
+    size_t words = nbytes / 4;
+    size_t rest = nbytes % 4;
+    asm volatile("rep movsl" : "+S" (source), "+D" (dest), "+c" (words) : : "memory");
+    asm volatile("rep movsb" : "+S" (source), "+D" (dest), "+c" (rest) : : "memory");
 }
 
 void memory_set(uint8_t *dest, uint8_t val, size_t len) {
@@ -12,20 +14,345 @@ void memory_set(uint8_t *dest, uint8_t val, size_t len) {
     for ( ; len != 0; len--) *temp++ = val;
 }
 
-/* This should be computed at link time, but a hardcoded
- * value is fine for now. Our kernel is small, so 0x20000 
- * is a safe start for the heap */
-uint32_t free_mem_addr = 0x20000;
+/* Fill 'count' dwords with 'val', for pixel spans */
+void memory_set32(uint32_t *dest, uint32_t val, size_t count) {
+    asm volatile("rep stosl" : "+D" (dest), "+c" (count) : "a" (val) : "memory");
+}
+
+/* Loads of four bytes at a time from byte buffers */
+typedef uint32_t __attribute__((may_alias)) word_t;
+
+#define ONES  0x01010101
+#define HIGHS 0x80808080
+
+/* The first 'c' in 'n' bytes from 's', or NULL. Once 's' is aligned the
+ * bytes are tested eight at a time: XOR with 'c' in every byte turns a
+ * match into a zero byte, and (x - ONES) & ~x has the high bit of the
+ * lowest zero byte set. */
+uint8_t *memory_find(uint8_t *s, uint8_t c, size_t n) {
+    for ( ; n && ((uint32_t)s & 3); s++, n--) {
+        if (*s == c) return s;
+    }
+
+    uint32_t pattern = c * ONES;
+    for ( ; n >= 8; s += 8, n -= 8) {
+        uint32_t x = *(word_t*)s ^ pattern;
+        uint32_t y = *(word_t*)(s + 4) ^ pattern;
+        if (((x - ONES) & ~x & HIGHS) | ((y - ONES) & ~y & HIGHS)) break;
+    }
+
+    for ( ; n; s++, n--) {
+        if (*s == c) return s;
+    }
+    return NULL;
+}
+
+/**
+ * The first occurrence of the 'm' bytes of 'needle' in the 'n' bytes
+ * of 'hay', or NULL. Short needles are found by scanning for their first
+ * byte with memory_find and comparing the rest. Longer ones use
+ * Boyer-Moore-Horspool: the byte under the end of the window says how
+ * far the needle can slide, up to its whole length when that byte is
+ * not in it.
+ */
+uint8_t *memory_search(uint8_t *hay, size_t n, uint8_t *needle, size_t m) {
+    if (m == 0) return hay;
+    if (m > n) return NULL;
+
+    if (m < SEARCH_SHIFT_MIN) {
+        uint8_t *end = hay + n - m + 1;
+        while (hay < end) {
+            hay = memory_find(hay, needle[0], end - hay);
+            if (!hay) return NULL;
+            size_t i = 1;
+            while (i < m && hay[i] == needle[i]) i++;
+            if (i == m) return hay;
+            hay++;
+        }
+        return NULL;
+    }
+
+    /* Shifts are capped at 255, which is only ever too short: safe */
+    uint8_t shift[256];
+    memory_set(shift, m < 255 ? m : 255, 256);
+    for (size_t i = m > 256 ? m - 256 : 0; i < m - 1; i++) shift[needle[i]] = m - 1 - i;
+
+    uint8_t last = needle[m - 1];
+    for (size_t pos = 0; pos <= n - m; pos += shift[hay[pos + m - 1]]) {
+        if (hay[pos + m - 1] != last || hay[pos] != needle[0]) continue;
+        size_t i = 1;
+        while (i < m - 1 && hay[pos + i] == needle[i]) i++;
+        if (i >= m - 1) return hay + pos;
+    }
+    return NULL;
+}
+
+/* The heap lives in [HEAP_START, HEAP_END). The kernel is loaded at
+ * 0x10000 and its stack sits below 0x90000, so the heap starts at 1MB,
+ * past the VGA memory and BIOS area.
+ *
+ * Every allocation is preceded by a header. Blocks are chained in
+ * address order so kfree can merge a block with its neighbours, and
+ * free blocks are also kept in one list per power-of-two size class,
+ * so finding a fit does not walk the whole heap. Memory that was never
+ * handed out is taken from the top, bumping 'free_mem_addr'.
+ *
+ * Whole pages (file data, mappings) come from the other end: they are
+ * carved downwards from HEAP_END and recycled through a free list, so
+ * they never fragment the heap with alignment gaps. */
+
+typedef struct heap_block {
+    uint32_t size;                /* Payload bytes */
+    uint32_t free;
+    struct heap_block *prev;      /* Previous block in memory */
+    struct heap_block *next_free; /* Size class list (free blocks only) */
+    struct heap_block *prev_free;
+} __attribute__((aligned(16))) heap_block_t;
+
+#define HEAP_ALIGN 16
+#define HEAP_CLASSES 27
+#define HEAP_MIN_SPLIT 32
+
+uint32_t free_mem_addr = HEAP_START;
+static heap_block_t *last_block = NULL;
+static heap_block_t *free_lists[HEAP_CLASSES];
+static uint32_t heap_used = 0;
+static uint32_t page_top = HEAP_END;
+static uint32_t free_pages = 0; /* Each free page holds the next one */
+static uint32_t pages_used = 0;
+
+static uint32_t align_up(uint32_t n, uint32_t align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+static heap_block_t *next_block(heap_block_t *b) {
+    if (b == last_block) return NULL;
+    return (heap_block_t*)((uint8_t*)(b + 1) + b->size);
+}
+
+/* Size class of a block: floor(log2(size)) */
+static int size_class(uint32_t size) {
+    int c = 0;
+    while (size > 1 && c < HEAP_CLASSES - 1) {
+        size >>= 1;
+        c++;
+    }
+    return c;
+}
+
+static void free_list_insert(heap_block_t *b) {
+    int c = size_class(b->size);
+    b->free = 1;
+    b->prev_free = NULL;
+    b->next_free = free_lists[c];
+    if (b->next_free) b->next_free->prev_free = b;
+    free_lists[c] = b;
+}
+
+static void free_list_remove(heap_block_t *b) {
+    if (b->prev_free) b->prev_free->next_free = b->next_free;
+    else free_lists[size_class(b->size)] = b->next_free;
+    if (b->next_free) b->next_free->prev_free = b->prev_free;
+    b->free = 0;
+    b->next_free = b->prev_free = NULL;
+}
+
+/* Cut 'b' down to 'size' bytes, turning the rest into a free block */
+static void split(heap_block_t *b, uint32_t size) {
+    if (b->size < size + sizeof(heap_block_t) + HEAP_MIN_SPLIT) return;
+
+    heap_block_t *rest = (heap_block_t*)((uint8_t*)(b + 1) + size);
+    rest->size = b->size - size - sizeof(heap_block_t);
+    rest->prev = b;
+    heap_block_t *after = next_block(b);
+    if (after) after->prev = rest;
+    else last_block = rest;
+    b->size = size;
+    free_list_insert(rest);
+}
+
+/* Merge 'b' (free, not listed) with the free block following it */
+static void merge_next(heap_block_t *b) {
+    heap_block_t *n = next_block(b);
+    if (!n || !n->free) return;
+    free_list_remove(n);
+    b->size += sizeof(heap_block_t) + n->size;
+    heap_block_t *after = next_block(n);
+    if (after) after->prev = b;
+    else last_block = b;
+}
+
+/* Payload address inside 'b' that satisfies 'align', leaving room for a
+ * free block in front of it if it is not the block start */
+static uint32_t aligned_payload(heap_block_t *b, uint32_t align) {
+    uint32_t start = (uint32_t)(b + 1);
+    if (align <= HEAP_ALIGN || (start & (align - 1)) == 0) return start;
+    return align_up(start + sizeof(heap_block_t) + HEAP_MIN_SPLIT, align);
+}
+
+static heap_block_t *find_fit(uint32_t size, uint32_t align) {
+    for (int c = size_class(size); c < HEAP_CLASSES; c++) {
+        for (heap_block_t *b = free_lists[c]; b; b = b->next_free) {
+            uint32_t payload = aligned_payload(b, align);
+            if (payload + size <= (uint32_t)(b + 1) + b->size) return b;
+        }
+    }
+    return NULL;
+}
+
+/* Grow the heap at the top with a block able to hold 'size' bytes */
+static heap_block_t *heap_extend(uint32_t size, uint32_t align) {
+    uint32_t start = free_mem_addr;
+    uint32_t payload = align_up(start + sizeof(heap_block_t), align);
+    uint32_t gap = payload - sizeof(heap_block_t) - start;
 
+    if (payload + size > page_top) return NULL;
+
+    /* The alignment gap becomes a free block if it is big enough, or
+     * else part of the block below it, so the chain stays contiguous */
+    if (gap >= sizeof(heap_block_t) + HEAP_MIN_SPLIT) {
+        heap_block_t *g = (heap_block_t*)start;
+        g->size = gap - sizeof(heap_block_t);
+        g->prev = last_block;
+        last_block = g;
+        free_list_insert(g);
+    } else if (gap && last_block) {
+        if (last_block->free) {
+            free_list_remove(last_block);
+            last_block->size += gap;
+            free_list_insert(last_block);
+        } else {
+            last_block->size += gap;
+            heap_used += gap;
+        }
+    }
+
+    heap_block_t *b = (heap_block_t*)(payload - sizeof(heap_block_t));
+    b->size = payload + size - (uint32_t)(b + 1);
+    b->free = 0;
+    b->prev = last_block;
+    b->next_free = NULL;
+    last_block = b;
+    free_mem_addr = payload + size;
+    return b;
+}
+
+/**
+ * Allocate 'size' bytes. If 'align' is 1 the memory is page aligned,
+ * as needed for page tables and DMA buffers. If 'phys_addr' is given,
+ * it receives the physical address (identical, we are identity mapped).
+ * Returns 0 when out of memory.
+ */
 uint32_t kmalloc(size_t size, int align, uint32_t *phys_addr) {
-    if (align == 1 && (free_mem_addr & 0xFFFFF000)) {
-        free_mem_addr &= 0xFFFFF000;
-        free_mem_addr += 0x1000;
+    uint32_t alignment = align == 1 ? 0x1000 : HEAP_ALIGN;
+    size = align_up(size ? size : 1, HEAP_ALIGN);
+
+    heap_block_t *b = find_fit(size, alignment);
+    if (b) {
+        free_list_remove(b);
+        uint32_t payload = aligned_payload(b, alignment);
+        if (payload != (uint32_t)(b + 1)) {
+            /* Leave the front of the block free, allocate from 'payload' */
+            heap_block_t *front = b;
+            b = (heap_block_t*)(payload - sizeof(heap_block_t));
+            b->size = (uint32_t)(front + 1) + front->size - payload;
+            b->prev = front;
+            heap_block_t *after = next_block(front);
+            front->size = (uint32_t)b - (uint32_t)(front + 1);
+            if (after) after->prev = b;
+            else last_block = b;
+            free_list_insert(front);
+        }
+        b->free = 0;
+        split(b, size);
+    } else {
+        b = heap_extend(size, alignment);
+        if (!b) return 0;
     }
-    
-    if (phys_addr) *phys_addr = free_mem_addr;
 
-    uint32_t ret = free_mem_addr;
-    free_mem_addr += size;
+    heap_used += b->size;
+    uint32_t ret = (uint32_t)(b + 1);
+    if (phys_addr) *phys_addr = ret;
     return ret;
 }
+
+void kfree(uint32_t addr) {
+    if (!addr) return;
+    heap_block_t *b = (heap_block_t*)addr - 1;
+    if (b->free) return;
+    heap_used -= b->size;
+
+    merge_next(b);
+    if (b->prev && b->prev->free) {
+        heap_block_t *p = b->prev;
+        free_list_remove(p);
+        p->size += sizeof(heap_block_t) + b->size;
+        heap_block_t *after = next_block(b);
+        if (after) after->prev = p;
+        else last_block = p;
+        b = p;
+    }
+    free_list_insert(b);
+}
+
+/* Resize an allocation, moving it if it cannot grow in place */
+uint32_t krealloc(uint32_t addr, size_t size) {
+    if (!addr) return kmalloc(size, 0, NULL);
+    heap_block_t *b = (heap_block_t*)addr - 1;
+    size = align_up(size ? size : 1, HEAP_ALIGN);
+    if (size <= b->size) return addr;
+
+    /* Try to absorb the free block that follows */
+    heap_block_t *n = next_block(b);
+    if (n && n->free && b->size + sizeof(heap_block_t) + n->size >= size) {
+        heap_used -= b->size;
+        merge_next(b);
+        split(b, size);
+        heap_used += b->size;
+        return addr;
+    }
+
+    /* Last block: just move the top of the heap */
+    if (b == last_block && addr + size <= page_top) {
+        heap_used += size - b->size;
+        b->size = size;
+        free_mem_addr = addr + size;
+        return addr;
+    }
+
+    uint32_t moved = kmalloc(size, 0, NULL);
+    if (!moved) return 0;
+    memory_copy((uint8_t*)addr, (uint8_t*)moved, b->size);
+    kfree(addr);
+    return moved;
+}
+
+uint32_t kheap_used() {
+    return heap_used;
+}
+
+/* Allocate one zeroed 4 KiB page, or return 0 */
+uint32_t kpage_alloc() {
+    uint32_t page = free_pages;
+    if (page) {
+        free_pages = *(uint32_t*)page;
+    } else {
+        if (page_top - PAGE_SIZE < free_mem_addr) return 0;
+        page_top -= PAGE_SIZE;
+        page = page_top;
+    }
+    pages_used++;
+    memory_set((uint8_t*)page, 0, PAGE_SIZE);
+    return page;
+}
+
+void kpage_free(uint32_t page) {
+    if (!page) return;
+    *(uint32_t*)page = free_pages;
+    free_pages = page;
+    pages_used--;
+}
+
+uint32_t kpages_used() {
+    return pages_used;
+}
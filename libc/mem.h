@@ -4,10 +4,26 @@
 #include <stdint.h>
 #include <stddef.h>
 
+/* Kernel heap, inside the identity mapped region (see cpu/paging.c) */
+#define HEAP_START 0x100000
+#define HEAP_END   0x4000000
+#define PAGE_SIZE  4096
+
+#define SEARCH_SHIFT_MIN 4 /* Needles this long are searched with a shift table */
+
 void memory_copy(uint8_t *source, uint8_t *dest, size_t nbytes);
 void memory_set(uint8_t *dest, uint8_t val, size_t len);
+void memory_set32(uint32_t *dest, uint32_t val, size_t count);
+uint8_t *memory_find(uint8_t *s, uint8_t c, size_t n);
+uint8_t *memory_search(uint8_t *hay, size_t n, uint8_t *needle, size_t m);
 
-/* At this stage there is no 'free' implemented. */
 uint32_t kmalloc(size_t size, int align, uint32_t *phys_addr);
+void kfree(uint32_t addr);
+uint32_t krealloc(uint32_t addr, size_t size);
+uint32_t kheap_used();
+
+uint32_t kpage_alloc();
+void kpage_free(uint32_t page);
+uint32_t kpages_used();
 
 #endif
@@ -0,0 +1,132 @@
+#include "printf.h"
+#include <stdint.h>
+
+/* Formatting for the kernel: %d %i %u %x %X %p %s %c and %%, with the
+ * '-' and '0' flags and a field width. 'l' is accepted and ignored,
+ * long is 32 bits here. The format is walked once, writing straight
+ * into 'buf'. */
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len; /* Would-be length: may pass 'size' */
+} out_t;
+
+static void put(out_t *o, char c) {
+    if (o->len + 1 < o->size) o->buf[o->len] = c;
+    o->len++;
+}
+
+static void pad(out_t *o, char c, int n) {
+    while (n-- > 0) put(o, c);
+}
+
+/* Write 'len' bytes of 's' in a field of 'width' */
+static void field(out_t *o, const char *s, int len, int width, int left, char fill) {
+    /* Zero padding goes between the sign and the digits */
+    if (fill == '0' && len > 0 && s[0] == '-') {
+        put(o, '-');
+        s++;
+        len--;
+        width--;
+    }
+    if (!left) pad(o, fill, width - len);
+    for (int i = 0; i < len; i++) put(o, s[i]);
+    if (left) pad(o, ' ', width - len);
+}
+
+/* Digits of 'n' in 'base', written backwards from the end of 'end' */
+static char *number(char *end, uint32_t n, int base, int upper) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do {
+        *--end = digits[n % base];
+        n /= base;
+    } while (n);
+    return end;
+}
+
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list args) {
+    out_t o = { buf, size, 0 };
+    char tmp[12];
+
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            put(&o, *fmt);
+            continue;
+        }
+
+        fmt++;
+        int left = 0;
+        char fill = ' ';
+        for (;; fmt++) {
+            if (*fmt == '-') left = 1;
+            else if (*fmt == '0') fill = '0';
+            else break;
+        }
+        if (left) fill = ' ';
+        int width = 0;
+        while (*fmt >= '0' && *fmt <= '9') width = width * 10 + (*fmt++ - '0');
+        while (*fmt == 'l') fmt++;
+
+        char *end = tmp + sizeof(tmp);
+        char *s;
+        switch (*fmt) {
+        case 'd':
+        case 'i': {
+            int32_t v = va_arg(args, int32_t);
+            s = number(end, v < 0 ? -(uint32_t)v : (uint32_t)v, 10, 0);
+            if (v < 0) *--s = '-';
+            field(&o, s, end - s, width, left, fill);
+            break;
+        }
+        case 'u':
+            s = number(end, va_arg(args, uint32_t), 10, 0);
+            field(&o, s, end - s, width, left, fill);
+            break;
+        case 'x':
+        case 'X':
+            s = number(end, va_arg(args, uint32_t), 16, *fmt == 'X');
+            field(&o, s, end - s, width, left, fill);
+            break;
+        case 'p':
+            s = number(end, (uint32_t)va_arg(args, void*), 16, 0);
+            put(&o, '0');
+            put(&o, 'x');
+            field(&o, s, end - s, width - 2, left, fill);
+            break;
+        case 's': {
+            s = va_arg(args, char*);
+            if (!s) s = "(null)";
+            int len = 0;
+            while (s[len]) len++;
+            field(&o, s, len, width, left, ' ');
+            break;
+        }
+        case 'c':
+            tmp[0] = (char)va_arg(args, int);
+            field(&o, tmp, 1, width, left, ' ');
+            break;
+        case '%':
+            put(&o, '%');
+            break;
+        case '\0':
+            fmt--; /* Lone '%' at the end */
+            break;
+        default:
+            put(&o, '%');
+            put(&o, *fmt);
+            break;
+        }
+    }
+
+    if (size) buf[o.len < size ? o.len : size - 1] = '\0';
+    return o.len;
+}
+
+int ksnprintf(char *buf, size_t size, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = kvsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
@@ -118,3 +118,12 @@ int strcmpi(char s1[], char s2[]) {
     }
     return tolower(s1[i]) - tolower(s2[i]);
 }
+
+/* Parse a non-negative decimal number, stopping at the first non-digit */
+int atoi(char s[]) {
+    int n = 0;
+    for (int i = 0; s[i] >= '0' && s[i] <= '9'; i++) {
+        n = n * 10 + (s[i] - '0');
+    }
+    return n;
+}
@@ -15,5 +15,6 @@ void strcpy(char *dest, char *src);
 void strcat(char *dest, const char *src);
 char tolower(char c);
 int strcmpi(char s1[], char s2[]);
+int atoi(char s[]);
 
 #endif
@@ -0,0 +1,184 @@
+/* Host-side tool: build a Sem Kernel disk image.
+ *
+ * Usage: mkfs <image> [-s size_kib] [-i inodes] [-j journal_blocks] [directory]
+ *
+ * The image is formatted with the layout described in fs/ondisk.h.
+ * If a directory is given, its tree is copied in: the top level of the
+ * directory becomes '/', and every file gets a single extent. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "../fs/ondisk.h"
+
+static uint8_t *image;
+static fs_superblock_t *sb;
+static uint32_t next_inode = 0;
+static uint32_t next_block;
+
+static uint8_t *block(uint32_t n) {
+    return image + (size_t)n * FS_BLOCK_SIZE;
+}
+
+static void bitmap_set(uint32_t first, uint32_t bit) {
+    block(first)[bit / 8] |= (1 << (bit % 8));
+}
+
+static fs_inode_t *inode_at(uint32_t ino) {
+    return (fs_inode_t*)block(sb->inode_table) + ino;
+}
+
+static int32_t add_inode(const char *name, int32_t parent, int is_dir) {
+    if (next_inode >= sb->inode_count) {
+        fprintf(stderr, "mkfs: out of inodes at '%s'\n", name);
+        exit(1);
+    }
+    if (strlen(name) >= FS_NAME_LEN) {
+        fprintf(stderr, "mkfs: name too long, skipping '%s'\n", name);
+        return -1;
+    }
+
+    uint32_t ino = next_inode++;
+    fs_inode_t *inode = inode_at(ino);
+    strcpy(inode->name, name);
+    inode->parent = parent;
+    inode->flags = FS_INODE_USED | (is_dir ? FS_INODE_DIR : 0);
+    bitmap_set(sb->inode_bitmap, ino);
+    return ino;
+}
+
+/* Store 'size' bytes in freshly allocated contiguous blocks */
+static void add_data(int32_t ino, const uint8_t *data, uint32_t size) {
+    uint32_t nblocks = (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    if (next_block + nblocks > sb->block_count) {
+        fprintf(stderr, "mkfs: image full\n");
+        exit(1);
+    }
+
+    fs_inode_t *inode = inode_at(ino);
+    inode->size = size;
+    if (nblocks == 0) return;
+
+    memcpy(block(next_block), data, size);
+    inode->extent_count = 1;
+    inode->extents[0].start = next_block;
+    inode->extents[0].length = nblocks;
+    for (uint32_t i = 0; i < nblocks; i++) bitmap_set(sb->block_bitmap, next_block + i);
+    next_block += nblocks;
+    sb->free_blocks -= nblocks;
+}
+
+static void add_tree(const char *path, int32_t parent) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        perror(path);
+        exit(1);
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        char child[4096];
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        struct stat st;
+        if (stat(child, &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            int32_t ino = add_inode(entry->d_name, parent, 1);
+            if (ino >= 0) add_tree(child, ino);
+        } else if (S_ISREG(st.st_mode)) {
+            int32_t ino = add_inode(entry->d_name, parent, 0);
+            if (ino < 0) continue;
+
+            FILE *f = fopen(child, "rb");
+            uint8_t *data = malloc(st.st_size + 1);
+            if (!f || !data || fread(data, 1, st.st_size, f) != (size_t)st.st_size) {
+                fprintf(stderr, "mkfs: cannot read '%s'\n", child);
+                exit(1);
+            }
+            add_data(ino, data, st.st_size);
+            free(data);
+            fclose(f);
+        }
+    }
+    closedir(dir);
+}
+
+static uint32_t blocks_for_bits(uint32_t bits) {
+    return (bits + FS_BITS_PER_BLOCK - 1) / FS_BITS_PER_BLOCK;
+}
+
+int main(int argc, char **argv) {
+    const char *out = NULL;
+    const char *tree = NULL;
+    uint32_t size_kib = 16384;
+    uint32_t inodes = 1024;
+    uint32_t journal = 256;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) size_kib = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) inodes = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) journal = atoi(argv[++i]);
+        else if (!out) out = argv[i];
+        else tree = argv[i];
+    }
+    if (!out) {
+        fprintf(stderr, "usage: %s <image> [-s size_kib] [-i inodes] [-j journal_blocks] [directory]\n", argv[0]);
+        return 1;
+    }
+    if (journal < FS_JOURNAL_MIN_BLOCKS) {
+        fprintf(stderr, "mkfs: the journal needs at least %d blocks\n", FS_JOURNAL_MIN_BLOCKS);
+        return 1;
+    }
+
+    uint32_t block_count = size_kib / (FS_BLOCK_SIZE / 1024);
+    image = calloc(block_count, FS_BLOCK_SIZE);
+    if (!image) return 1;
+
+    sb = (fs_superblock_t*)block(0);
+    sb->magic = FS_MAGIC;
+    sb->version = FS_VERSION;
+    sb->block_size = FS_BLOCK_SIZE;
+    sb->block_count = block_count;
+    sb->inode_count = inodes;
+    sb->inode_bitmap = 1;
+    sb->block_bitmap = sb->inode_bitmap + blocks_for_bits(inodes);
+    sb->block_bitmap_blocks = blocks_for_bits(block_count);
+    sb->inode_table = sb->block_bitmap + sb->block_bitmap_blocks;
+    sb->inode_table_blocks = (inodes + FS_INODES_PER_BLOCK - 1) / FS_INODES_PER_BLOCK;
+    sb->journal_start = sb->inode_table + sb->inode_table_blocks;
+    sb->journal_blocks = journal;
+    sb->data_start = sb->journal_start + sb->journal_blocks;
+    if (sb->data_start >= block_count) {
+        fprintf(stderr, "mkfs: image too small\n");
+        return 1;
+    }
+
+    /* Metadata blocks are never handed out to files */
+    for (uint32_t i = 0; i < sb->data_start; i++) bitmap_set(sb->block_bitmap, i);
+    sb->free_blocks = block_count - sb->data_start;
+    next_block = sb->data_start;
+
+    /* An empty journal: nothing to replay before the first transaction */
+    fs_journal_block_t *header = (fs_journal_block_t*)block(sb->journal_start);
+    header->magic = FS_JOURNAL_MAGIC;
+    header->type = FS_JOURNAL_HEADER;
+    header->sequence = 1;
+
+    if (tree) add_tree(tree, FS_ROOT_PARENT);
+
+    FILE *f = fopen(out, "wb");
+    if (!f || fwrite(image, FS_BLOCK_SIZE, block_count, f) != block_count) {
+        perror(out);
+        return 1;
+    }
+    fclose(f);
+
+    printf("%s: %u blocks, %u inodes (%u used), %u blocks free\n",
+           out, block_count, inodes, next_inode, sb->free_blocks);
+    return 0;
+}
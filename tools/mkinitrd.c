@@ -0,0 +1,123 @@
+/* Host-side tool: pack a directory into an initrd archive.
+ *
+ * Usage: mkinitrd <archive> <directory>
+ *
+ * The layout is described in fs/initrd.h. The top level of the
+ * directory becomes '/'. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "../fs/initrd.h"
+
+typedef struct {
+    initrd_entry_t entry;
+    uint8_t *data;
+} node_t;
+
+static node_t *nodes = NULL;
+static uint32_t count = 0;
+static uint32_t capacity = 0;
+
+static int32_t add_node(const char *name, int32_t parent, uint32_t flags) {
+    if (strlen(name) >= FS_NAME_LEN) {
+        fprintf(stderr, "mkinitrd: name too long, skipping '%s'\n", name);
+        return -1;
+    }
+    if (count == capacity) {
+        capacity = capacity ? capacity * 2 : 64;
+        nodes = realloc(nodes, capacity * sizeof(node_t));
+        if (!nodes) exit(1);
+    }
+
+    node_t *n = &nodes[count];
+    memset(n, 0, sizeof(*n));
+    strcpy(n->entry.name, name);
+    n->entry.parent = parent;
+    n->entry.flags = flags;
+    return count++;
+}
+
+static void add_tree(const char *path, int32_t parent) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        perror(path);
+        exit(1);
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        char child[4096];
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        struct stat st;
+        if (stat(child, &st) != 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            int32_t index = add_node(entry->d_name, parent, INITRD_DIR);
+            if (index >= 0) add_tree(child, index);
+        } else if (S_ISREG(st.st_mode)) {
+            int32_t index = add_node(entry->d_name, parent, 0);
+            if (index < 0) continue;
+
+            FILE *f = fopen(child, "rb");
+            uint8_t *data = malloc(st.st_size + 1);
+            if (!f || !data || fread(data, 1, st.st_size, f) != (size_t)st.st_size) {
+                fprintf(stderr, "mkinitrd: cannot read '%s'\n", child);
+                exit(1);
+            }
+            fclose(f);
+            nodes[index].data = data;
+            nodes[index].entry.size = st.st_size;
+        }
+    }
+    closedir(dir);
+}
+
+static uint32_t align_up(uint32_t n) {
+    return (n + INITRD_ALIGN - 1) & ~(INITRD_ALIGN - 1);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <archive> <directory>\n", argv[0]);
+        return 1;
+    }
+
+    add_tree(argv[2], FS_ROOT_PARENT);
+
+    uint32_t offset = align_up(sizeof(initrd_header_t) + count * sizeof(initrd_entry_t));
+    for (uint32_t i = 0; i < count; i++) {
+        if (nodes[i].entry.flags & INITRD_DIR) continue;
+        nodes[i].entry.offset = offset;
+        offset = align_up(offset + nodes[i].entry.size);
+    }
+
+    initrd_header_t header;
+    header.magic = INITRD_MAGIC;
+    header.count = count;
+    header.size = offset;
+
+    uint8_t *archive = calloc(1, offset);
+    if (!archive) return 1;
+    memcpy(archive, &header, sizeof(header));
+    for (uint32_t i = 0; i < count; i++) {
+        initrd_entry_t *e = &nodes[i].entry;
+        memcpy(archive + sizeof(header) + i * sizeof(initrd_entry_t), e, sizeof(*e));
+        if (nodes[i].data) memcpy(archive + e->offset, nodes[i].data, e->size);
+    }
+
+    FILE *f = fopen(argv[1], "wb");
+    if (!f || fwrite(archive, 1, offset, f) != offset) {
+        perror(argv[1]);
+        return 1;
+    }
+    fclose(f);
+
+    printf("%s: %u entries, %u bytes\n", argv[1], count, offset);
+    return 0;
+}